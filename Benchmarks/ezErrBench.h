@@ -0,0 +1,89 @@
+//
+//  ezErrBench.h
+//
+//  Timing harness shared by the Objective-C and Objective-C++ benchmarks.
+//
+
+#import "ezErr.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// One benchmark case: reports error through one of the macros
+typedef void (*ezBenchCase)(NSError *error);
+
+// Bumped by ezErrBlockReturn's block so the compiler can't drop it
+static volatile uint64_t ezBenchBlockRuns;
+
+static inline uint64_t ezBenchNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Bytes malloc has handed out and not had back. Only glibc tells us.
+static inline long long ezBenchLiveBytes(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return (long long)mallinfo2().uordblks;
+#else
+    return -1;
+#endif
+}
+
+// Peak resident set of the process, in kilobytes on Linux
+static inline long ezBenchPeakKB(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* ezBenchRun(name, body, errors, iterations)
+ *
+ * Calls body iterations times, cycling through errors (nil for the nil path), and prints ns/op and
+ * the bytes still live per op once the run's pool has drained.
+ **/
+
+static inline void ezBenchRun(const char *name, ezBenchCase body, NSArray *errors, uint64_t iterations)
+{
+    NSUInteger count = errors.count;
+    long long liveBefore = ezBenchLiveBytes();
+    uint64_t start = ezBenchNanos();
+    @autoreleasepool {
+        for (uint64_t i = 0; i < iterations; i++) {
+            body(count ? errors[i % count] : nil);
+        }
+    }
+    uint64_t elapsed = ezBenchNanos() - start;
+    long long liveAfter = ezBenchLiveBytes();
+
+    if (liveBefore < 0) {
+        printf("%-36s %10.1f ns/op\n", name, (double)elapsed / iterations);
+    } else {
+        printf("%-36s %10.1f ns/op %10.1f live B/op\n", name, (double)elapsed / iterations,
+               (double)(liveAfter - liveBefore) / iterations);
+    }
+}
+
+// Distinct errors, so every report takes the full path instead of being folded into a repeat
+static inline NSArray *ezBenchDistinctErrors(NSUInteger count)
+{
+    NSMutableArray *errors = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [errors addObject:[NSError errorWithDomain:@"ezErrBench" code:(NSInteger)i
+                                          userInfo:@{NSLocalizedDescriptionKey: @"Benchmark error"}]];
+    }
+    return errors;
+}
+
+// Implemented in ezErrBenchCxx.mm
+#ifdef __cplusplus
+extern "C"
+#endif
+void ezBenchRunCxx(uint64_t iterations);
@@ -0,0 +1,136 @@
+//
+//  ezErrBench.m
+//
+//  ns/op and allocation numbers for ezErr, ezErrReturn and ezErrBlockReturn with real NSErrors, and log file
+//  throughput with plain appends against ezErrSetLogFileSegments.
+//  Build and run with `make bench` from the repository root.
+//
+
+#import "ezErrBench.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void benchErr(NSError *error)
+{
+    (void)ezErr(error, @"Benchmark");
+}
+
+static void benchReturn(NSError *error)
+{
+    ezErrReturn(error, @"Benchmark");
+}
+
+static void benchBlockReturn(NSError *error)
+{
+    ezErrBlockReturn(error, @"Benchmark", ezBenchBlockRuns++);
+}
+
+// The macros used to check their argument twice per report and now check it once; these time the check alone
+static volatile uint64_t benchChecks;
+
+static void benchCheckOnce(NSError *error)
+{
+    benchChecks += _as_isError(error);
+}
+
+static void benchCheckTwice(NSError *error)
+{
+    benchChecks += _as_isError(error);
+    benchChecks += _as_isError(error);
+}
+
+// Waits for everything reported so far to reach the log file, including a queued close
+static void benchSettle(void)
+{
+    (void)ezErrRecentLogs(); // a round trip through the writer, which hands writes to the file queue in order
+    dispatch_sync(_as_fileQueue(), ^{});
+}
+
+/* benchLogFile(name, segmentBytes, direct, errors, iterations)
+ *
+ * Reports iterations errors into a fresh file in the temporary directory and times them until the file is closed,
+ * so appends and segments, which trim their reserve on close, pay for the same work. Prints ns/op, MB/s of log written
+ * and the logs dropped on the way, since a run that drops logs writes less.
+ **/
+
+static void benchLogFile(const char *name, size_t segmentBytes, BOOL direct, NSArray *errors, uint64_t iterations)
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"ezErrBench.log"];
+    unlink(path.fileSystemRepresentation);
+    ezErrSetLogFileSegments(segmentBytes, direct);
+    if (!ezErrSetLogFile(path)) {
+        fprintf(stderr, "Couldn't open %s as the log file\n", path.fileSystemRepresentation);
+        return;
+    }
+    benchSettle();
+
+    ezErrStats before;
+    ezErrStatsSnapshot(&before);
+    NSUInteger count = errors.count;
+    uint64_t start = ezBenchNanos();
+    @autoreleasepool {
+        for (uint64_t i = 0; i < iterations; i++) {
+            benchErr(errors[i % count]);
+        }
+    }
+    ezErrSetLogFile(nil);
+    benchSettle();
+    uint64_t elapsed = ezBenchNanos() - start;
+
+    ezErrStats after;
+    ezErrStatsSnapshot(&after);
+    struct stat file;
+    off_t size = stat(path.fileSystemRepresentation, &file) == 0 ? file.st_size : 0;
+    printf("%-36s %10.1f ns/op %10.1f MB/s %10llu dropped\n", name, (double)elapsed / iterations,
+           (double)size / ((double)elapsed / 1e9) / 1e6, (unsigned long long)(after.droppedLogs - before.droppedLogs));
+    unlink(path.fileSystemRepresentation);
+}
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        uint64_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+        if (!iterations) iterations = 1;
+
+        // Logs still go through the writer, they just don't fill the terminal
+        if (!ezErrSetLogFile(@"/dev/null")) {
+            fprintf(stderr, "Couldn't open /dev/null as the log file\n");
+            return 1;
+        }
+
+        NSArray *none = @[];
+        NSArray *same = ezBenchDistinctErrors(1);
+        NSArray *distinct = ezBenchDistinctErrors(1024);
+
+        printf("%llu iterations per case\n", (unsigned long long)iterations);
+        ezBenchRun("error check once, nil", benchCheckOnce, none, iterations);
+        ezBenchRun("error check twice, nil", benchCheckTwice, none, iterations);
+        ezBenchRun("error check once, error", benchCheckOnce, same, iterations);
+        ezBenchRun("error check twice, error", benchCheckTwice, same, iterations);
+        ezBenchRun("ezErr nil", benchErr, none, iterations);
+        ezBenchRun("ezErr repeated error", benchErr, same, iterations);
+        ezBenchRun("ezErr distinct errors", benchErr, distinct, iterations);
+        ezBenchRun("ezErrReturn nil", benchReturn, none, iterations);
+        ezBenchRun("ezErrReturn repeated error", benchReturn, same, iterations);
+        ezBenchRun("ezErrReturn distinct errors", benchReturn, distinct, iterations);
+        ezBenchRun("ezErrBlockReturn nil", benchBlockReturn, none, iterations);
+        ezBenchRun("ezErrBlockReturn repeated error", benchBlockReturn, same, iterations);
+        ezBenchRun("ezErrBlockReturn distinct errors", benchBlockReturn, distinct, iterations);
+        ezBenchRunCxx(iterations);
+
+        benchLogFile("log file appends", 0, NO, distinct, iterations);
+        benchLogFile("log file 4 MB segments", 4 << 20, NO, distinct, iterations);
+        benchLogFile("log file 4 MB segments, direct", 4 << 20, YES, distinct, iterations);
+        ezErrSetLogFileSegments(0, NO);
+
+        ezErrStats stats;
+        ezErrStatsSnapshot(&stats);
+        printf("reported %llu, dropped logs %llu, peak RSS %ld KB\n",
+               (unsigned long long)stats.count, (unsigned long long)stats.droppedLogs, ezBenchPeakKB());
+
+        ezErrSetLogFile(nil);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+//
+//  ezErrBenchCxx.mm
+//
+//  The same cases from Objective-C++, where an argument typed NSError * skips the dynamic class check,
+//  next to an id argument that still takes it. Also links a second file importing ezErr.h into the binary.
+//
+
+#import "ezErrBench.h"
+
+static void benchErrTyped(NSError *error)
+{
+    (void)ezErr(error, @"Benchmark");
+}
+
+static void benchErrUntyped(NSError *error)
+{
+    id untyped = error;
+    (void)ezErr(untyped, @"Benchmark");
+}
+
+static void benchReturnTyped(NSError *error)
+{
+    ezErrReturn(error, @"Benchmark");
+}
+
+static void benchBlockReturnTyped(NSError *error)
+{
+    ezErrBlockReturn(error, @"Benchmark", ezBenchBlockRuns++);
+}
+
+static void benchErrF(NSError *error)
+{
+    (void)ezErrF(error, "Benchmark {}", 42);
+}
+
+extern "C" void ezBenchRunCxx(uint64_t iterations)
+{
+    NSArray *none = @[];
+    NSArray *same = ezBenchDistinctErrors(1);
+    NSArray *distinct = ezBenchDistinctErrors(1024);
+
+    ezBenchRun("C++ ezErr nil, NSError *", benchErrTyped, none, iterations);
+    ezBenchRun("C++ ezErr nil, id", benchErrUntyped, none, iterations);
+    ezBenchRun("C++ ezErr repeated, NSError *", benchErrTyped, same, iterations);
+    ezBenchRun("C++ ezErr repeated, id", benchErrUntyped, same, iterations);
+    ezBenchRun("C++ ezErr distinct, NSError *", benchErrTyped, distinct, iterations);
+    ezBenchRun("C++ ezErrReturn repeated", benchReturnTyped, same, iterations);
+    ezBenchRun("C++ ezErrBlockReturn repeated", benchBlockReturnTyped, same, iterations);
+    ezBenchRun("C++ ezErrF distinct", benchErrF, distinct, iterations);
+}
@@ -0,0 +1,86 @@
+//
+//  ezErrPeakMemoryTest.m
+//
+//  Reports a million errors from a thread with no autorelease pool of its own and checks that peak memory
+//  stays flat: the reporting path has to drain what it autoreleases. Run with `make test`.
+//
+
+#import <Foundation/Foundation.h>
+#import "ezErr.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#define kWarmupReports  100000
+#define kReports        1000000
+#define kDistinctErrors 1024
+#define kAllowedGrowth  (16 * 1024) // KB. Twenty leaked objects per report would be a gigabyte.
+
+static NSArray *errors;
+
+// Peak resident set of the process, in kilobytes on Linux
+static long peakKB(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// No @autoreleasepool here on purpose
+static void *report(void *reports)
+{
+    for (uintptr_t i = 0; i < (uintptr_t)reports; i++) {
+        NSError *error = errors[i % kDistinctErrors];
+        (void)ezErr(error, @"Peak memory test");
+    }
+    return NULL;
+}
+
+static void reportOnThread(uintptr_t reports)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, report, (void *)reports);
+    pthread_join(thread, NULL);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        if (!ezErrSetLogFile(@"/dev/null")) {
+            fprintf(stderr, "Couldn't open /dev/null as the log file\n");
+            return 1;
+        }
+
+        // Distinct errors, so no report is folded into a repeat
+        NSMutableArray *list = [NSMutableArray arrayWithCapacity:kDistinctErrors];
+        for (NSInteger i = 0; i < kDistinctErrors; i++) {
+            [list addObject:[NSError errorWithDomain:@"ezErrPeakMemoryTest" code:i
+                                            userInfo:@{NSLocalizedDescriptionKey: @"Peak memory test error"}]];
+        }
+        errors = list;
+
+        // Let the statistics tables, sketches and writer reach their working size first
+        reportOnThread(kWarmupReports);
+        long warm = peakKB();
+        reportOnThread(kReports);
+        long peak = peakKB();
+
+        ezErrStats stats;
+        ezErrStatsSnapshot(&stats);
+        printf("peak RSS %ld KB after %d reports, %ld KB after %d more (%llu reported, %llu logs dropped)\n",
+               warm, kWarmupReports, peak, kReports, (unsigned long long)stats.count, (unsigned long long)stats.droppedLogs);
+        ezErrSetLogFile(nil);
+
+        if (stats.count < kWarmupReports + kReports) {
+            fprintf(stderr, "FAIL: only %llu of %d reports were counted\n", (unsigned long long)stats.count, kWarmupReports + kReports);
+            return 1;
+        }
+        if (peak - warm > kAllowedGrowth) {
+            fprintf(stderr, "FAIL: peak memory grew by %ld KB, more than %d KB\n", peak - warm, kAllowedGrowth);
+            return 1;
+        }
+        printf("PASS\n");
+    }
+    return 0;
+}
@@ -37,7 +37,57 @@
 #ifndef ezErr_h
 #define ezErr_h
 
-#pragma mark - ezErr(error, detail);
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#ifdef __cplusplus
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#endif
+
+#if __has_include(<dispatch/dispatch.h>)
+#include <dispatch/dispatch.h>
+#define _as_hasDispatch 1
+#endif
+
+// Builds against Apple Foundation, or GNUstep Base with libobjc2 and libdispatch (clang -fobjc-arc -fblocks).
+#ifdef __OBJC__
+#import <Foundation/Foundation.h>
+#endif
+
+// Background work runs at utility QoS where there is one. Older libdispatch on Linux only has priorities.
+#ifdef __APPLE__
+#define _as_kUtilityQoS QOS_CLASS_UTILITY
+#else
+#define _as_kUtilityQoS DISPATCH_QUEUE_PRIORITY_LOW
+#endif
+
+// C and C++ files importing ezErr.h get only the parts that don't need Objective-C, see C API below.
+#if !defined(__OBJC__) && !defined(OBJC_BOOL_DEFINED)
+#include <stdbool.h>
+typedef bool BOOL;
+#define YES true
+#define NO false
+#endif
+
+// MARK: - ezErr(error, detail);
 
 /* ezErr(NSError *, NSString *)
  *
@@ -48,7 +98,7 @@
 **/
 
 #define ezErr(error, detail)\
-( (_as_convertForLog(error, detail )) , [error isKindOfClass:[NSError class]] && error.domain)
+(_as_isError(error) ? (_as_convertForLog(error, detail), YES) : NO)
 
 /* example use for ezErr
 
@@ -64,7 +114,7 @@
  }
 */
 
-#pragma mark - ezErrReturn(error, detail)
+// MARK: - ezErrReturn(error, detail)
 /* ezErrReturn (NSError *, NSString *)
  *
  * Checks if error exists.
@@ -75,7 +125,7 @@
  **/
 
 #define ezErrReturn(error, detail)\
-if ([error isKindOfClass:[NSError class]] && error.domain){\
+if (_as_isError(error)){\
 _as_convertForLog(error, detail);\
 return;\
 }
@@ -100,7 +150,7 @@ return;\
 */
 
 
-#pragma mark - ezErrBlockReturn
+// MARK: - ezErrBlockReturn
 
 /* ezErrBlockReturn(NSError *, NSString *, block)
  *
@@ -112,7 +162,7 @@ return;\
  **/
 
 #define ezErrBlockReturn(error, detail, ...)\
-if ([error isKindOfClass: [NSError class]] && error.domain){\
+if (_as_isError(error)){\
 _as_convertForLog(error, detail);\
 (__VA_ARGS__);\
 return;\
@@ -142,8 +192,9 @@ return;\
  }
  */
 
-#pragma mark - Notification keys
+// MARK: - Notification keys
 
+#ifdef __OBJC__
 // Observe this notification to receive error info as NSErrors are found
 static NSString * const kEzErrNotification = @"kEzErrNotification";
 
@@ -156,71 +207,4563 @@ static NSString * const kEzErrThredKey    = @"kEzErrThreadKey"; //NSNumber of 1
 static NSString * const kEzErrDateKey     = @"kEzErrDateKey"; //NSDate
 static NSString * const kEzErrCodeKey     = @"kEzErrCodeKey"; //NSNumber
 static NSString * const kEzErrDomainKey   = @"kEzErrDomainKey";
+static NSString * const kEzErrClassKey    = @"kEzErrClassKey"; //NSNumber of an ezErrClass
+static NSString * const kEzErrFirstSeenKey = @"kEzErrFirstSeenKey"; //NSNumber of 1 the first time this site, domain and code is seen in kEzErrFirstSeenPeriod
+static NSString * const kEzErrErrorKey    = @"kEzErrErrorKey"; //the NSError itself
+static NSString * const kEzErrRepeatsKey  = @"kEzErrRepeatsKey"; //NSNumber, only on repeat summaries: how many reports this one stands for. See Repeats.
 
+// Errors ezErr reports about itself use this domain
+static NSString * const kEzErrSelfDomain  = @"ezErr";
+#endif
 
-/////////////////////////////////////////////////////////////////
-// Anything below this line is not intended to be used directly.
+typedef enum {
+    kEzErrSelfSinkFailedOver = 1,
+    kEzErrSelfDomainRateAnomaly,  // a domain's error rate jumped. See Anomalies.
+    kEzErrSelfSiteRateAnomaly,    // one call site's error rate jumped
+} ezErrSelfCode;
 
-#pragma mark - Internal methods
 
-// Gathers info about the error method and passes it to logging function
-#define _as_convertForLog(error, summary)\
-(_as_logErr(error, summary, [[NSString stringWithFormat:@"%s",__FILE__]lastPathComponent], [NSString stringWithFormat:@"%s",__FUNCTION__], [NSString stringWithFormat:@"%d",__LINE__], [NSThread isMainThread]))
+// MARK: - Sinks
 
+/* ezErrSetLogFile(NSString *)
+ *
+ * Appends logs to the file at path instead of the console. Pass nil to go back to the console.
+ * Passes back NO if the file can't be opened.
+ * File writes are timed and checked. If a write fails 3 times in a row, or one write is stuck for
+ * kEzErrSinkStallTimeout seconds (full disk, hung network mount), ezErr fails over to the fallback sink
+ * and reports a kEzErrSelfSinkFailedOver error there. It stays on the fallback until ezErrSetLogFile is called again.
+ * While a write is still stuck, ezErrSetLogFile with a path passes back NO: file writes run one at a time, so the new
+ * file would only queue behind it. Try again once the stuck write has returned.
+ **/
 
-//Performs the logging and notification sending
+typedef enum {
+    kEzErrSinkConsole, // NSLog
+    kEzErrSinkStderr,
+    kEzErrSinkMemory,  // the latest logs, kept in memory. See ezErrRecentLogs.
+} ezErrSink;
 
-void _as_logErr(NSError *error,
-                NSString *detail,
-                NSString *file,
-                NSString *function,
-                NSString *line,
-                BOOL onMainThread)
+#ifdef __OBJC__
+static inline BOOL ezErrSetLogFile(NSString *path);
 
-{
-    // Check error
-    if (! [ error isKindOfClass:[NSError class]] || !error.domain) return;
-   
-    // Protect against nil fields
-    if (! detail) detail = @"No detail";
-    NSString *localizedDescription = error.localizedDescription;
-
-    NSString *domain = error.domain;
-    NSString *code = [NSString stringWithFormat:@"%i", (int)error.code];
-
-
-    // Generate log strings
-    
-    NSString *layer1 = @"\n* * * * * * * * [NSError found]";
-    NSString *layer2 = [NSString stringWithFormat:@"\n* Detail        : %@",detail];
-    NSString *layer3 = [NSString stringWithFormat:@"\n* Description   : %@", localizedDescription];
-    NSString *layer4 = [NSString stringWithFormat:@"\n* Method name   : %@",function];
-    NSString *layer5 = [NSString stringWithFormat:@"\n* File name     : %@", file];
-    NSString *layer6 = [NSString stringWithFormat:@"\n* Line number   : %@", line];
-    NSString *layer7 = [NSString stringWithFormat:@"\n* Main thread   : %s", onMainThread? "Yes" : "No"];
-    NSString *layer8 = [NSString stringWithFormat:@"\n* Error domain  : %@",domain];
-    NSString *layer9 = [NSString stringWithFormat:@"\n* Error code    : %@",code];
-    NSString *layer10= [NSString stringWithFormat:@"\n* * * * * * * * [End of ezErr log]"];
-    
-    
-    NSString *logStatement = [NSString stringWithFormat:@"%@%@%@%@%@%@%@%@%@%@", layer1, layer2, layer3, layer4, layer5, layer6, layer7, layer8, layer9, layer10];
-    
-    NSLog(@"%@",logStatement);
-    
-    // Post dictionary with error info for analytics or other use.
-
-    NSDictionary *errorInfo = @{kEzErrDetailKey   : detail,
-                                kEzErrFileKey     : file,
-                                kEzErrFunctionKey : function,
-                                kEzErrLineKey     : line,
-                                kEzErrThredKey    : [NSNumber numberWithBool:onMainThread],
-                                kEzErrDateKey     : [NSDate date],
-                                kEzErrDomainKey   : domain,
-                                kEzErrCodeKey     : code};
-    
-    [[NSNotificationCenter defaultCenter] postNotificationName:kEzErrNotification
-                                                        object:nil
-                                                      userInfo:errorInfo];
+/* ezErrSetLogFileSegments(size_t segmentBytes, BOOL direct)
+ *
+ * Appends grow the log file a few blocks at a time, each growth a metadata update, and a busy log file ends up in
+ * fragments. With a segment size, ezErr reserves the file segmentBytes at a time (posix_fallocate, or F_PREALLOCATE on
+ * Apple), writes logs in place, and trims the unused reserve when the file is closed, such as by ezErrSetLogFile(nil)
+ * at shutdown. After a crash the file ends in zeros up to the segment end, and ezErr picks up after the last log
+ * when it opens the file again.
+ * direct keeps logs out of the page cache: O_DIRECT, with writes from kEzErrLogFileAlignment aligned buffers (glibc
+ * only declares O_DIRECT with _GNU_SOURCE), or F_NOCACHE on Apple. Filesystems that refuse O_DIRECT get normal writes.
+ * Set it before ezErrSetLogFile. 0, the default, appends as before.
+ **/
+
+#ifndef kEzErrLogFileAlignment
+#define kEzErrLogFileAlignment 4096
+#endif
+
+static inline void ezErrSetLogFileSegments(size_t segmentBytes, BOOL direct);
+
+/* ezErrSetFallbackSink(ezErrSink)
+ *
+ * Where logs go after the log file fails. Defaults to kEzErrSinkStderr.
+ **/
+
+static inline void ezErrSetFallbackSink(ezErrSink sink);
+
+/* ezErrRecentLogs()
+ *
+ * Passes back the logs written to the memory sink, oldest first.
+ **/
+
+static inline NSArray *ezErrRecentLogs(void);
+#endif
+
+
+// MARK: - Memory budget
+
+/* ezErrSetMemoryBudget(size_t)
+ *
+ * Caps the memory ezErr holds, in bytes, across every internal structure. 0 means no cap.
+ * Defaults to kEzErrDefaultMemoryBudget.
+ * Under pressure ezErr first lets go of what it can rebuild, and only then drops logs: each thread's repeat cache
+ * at once, then on the writer the older half of the memory sink and the mined templates.
+ * Dropped logs are counted in ezErrStats.droppedLogs. Statistics and notifications are never dropped.
+ * Current usage per component is in ezErrStats.memoryUsage.
+ **/
+
+#ifndef kEzErrDefaultMemoryBudget
+#define kEzErrDefaultMemoryBudget (4 * 1024 * 1024)
+#endif
+
+typedef enum {
+    kEzErrMemoryQueued,     // logs waiting for the writer or the log file
+    kEzErrMemoryRecentLogs, // the memory sink
+    kEzErrMemoryDomains,    // domain names in the statistics table
+    kEzErrMemorySketches,   // cardinality sketches and first-occurrence filters
+    kEzErrMemorySLOs,       // error budget counters and history
+    kEzErrMemoryTemplates,  // mined detail templates
+    kEzErrMemoryRepeats,    // each thread's cache of its last reports
+    kEzErrMemoryComponentCount
+} ezErrMemoryComponent;
+
+static inline void ezErrSetMemoryBudget(size_t bytes);
+
+
+// MARK: - First occurrence
+
+/* The first time a kind of error, (site, domain, code), is reported, its log also carries the call stack.
+ * Repeats get the usual short log. "Seen" is remembered for one to two kEzErrFirstSeenPeriod periods (default one hour),
+ * in a pair of rotating Bloom filters, so the check is a few bit tests. A rare false positive costs one short log.
+ **/
+
+#ifndef kEzErrFirstSeenPeriod
+#define kEzErrFirstSeenPeriod 3600
+#endif
+
+
+// MARK: - User info
+
+/* ezErrSetUserInfoKeys(NSArray *)
+ *
+ * Sets which userInfo keys are logged. nil means the defaults: the underlying error, file path, failing URL,
+ * failure reason and debug description. An empty array logs none.
+ * Values are copied on the reporting thread into at most kEzErrUserInfoMaxBytes of CBOR, and turned into text on the writer,
+ * so a huge userInfo costs no more than a small one. Nesting stops at kEzErrUserInfoMaxDepth, strings are cut at
+ * kEzErrUserInfoMaxString bytes and dictionaries and arrays at kEzErrUserInfoMaxEntries entries.
+ * Underlying errors are logged with their domain, code and the same allowed keys.
+ * Meant to be called at startup: earlier lists are never freed, so readers don't need a lock.
+ **/
+
+#ifndef kEzErrUserInfoMaxBytes
+#define kEzErrUserInfoMaxBytes 1024
+#endif
+
+#ifndef kEzErrUserInfoMaxDepth
+#define kEzErrUserInfoMaxDepth 3
+#endif
+
+#ifndef kEzErrUserInfoMaxString
+#define kEzErrUserInfoMaxString 256
+#endif
+
+#ifndef kEzErrUserInfoMaxEntries
+#define kEzErrUserInfoMaxEntries 16
+#endif
+
+#if kEzErrUserInfoMaxEntries > 23
+#error kEzErrUserInfoMaxEntries has to fit a one byte CBOR header (at most 23)
+#endif
+
+#ifdef __OBJC__
+static inline void ezErrSetUserInfoKeys(NSArray *keys);
+#endif
+
+
+// MARK: - Repeats
+
+/* One NSError is often handed to many checks, like a connection-down error failing every pending request.
+ * When a thread reports the same error instance with the same detail instance at the same site as its last report there,
+ * the repeat is counted (statistics, error budgets, anomalies) but not formatted, logged or posted.
+ * Every kEzErrRepeatInterval seconds while repeats keep coming, one short log and one kEzErrNotification with
+ * kEzErrRepeatsKey say how many there were. ezErrStats.repeats counts them all.
+ * Each thread keeps its latest error per site alive until another error is reported there, or the thread exits;
+ * repeats not yet summed up are summed up then.
+ **/
+
+#ifndef kEzErrRepeatInterval
+#define kEzErrRepeatInterval 1.0
+#endif
+
+
+// MARK: - Detail templates
+
+/* ezErrSetTemplateMining(BOOL)
+ *
+ * Details built with stringWithFormat: make nearly every log unique. With template mining on, the writer sorts details
+ * into templates as they arrive, Drain style: a parse tree of fixed depth keyed by token count and the leading tokens,
+ * then token by token similarity within a leaf. "Fetch user 42 failed" and "Fetch user 97 failed" both become
+ * T3, "Fetch user <*> failed", and their logs carry only "T3 [42]" and "T3 [97]". A template's text is logged when it
+ * first appears and whenever it widens. Off by default.
+ * At most kEzErrMaxTemplates templates are kept; details that would need more are logged as they are.
+ * Templates are let go when the memory budget runs short, and mining starts over with new IDs.
+ *
+ * ezErrTemplates() passes back the templates, most used first, as dictionaries with kEzErrTemplateIDKey,
+ * kEzErrTemplateKey and kEzErrTemplateCountKey.
+ **/
+
+#ifndef kEzErrMaxTemplates
+#define kEzErrMaxTemplates 1024
+#endif
+
+#ifndef kEzErrTemplateDepth
+#define kEzErrTemplateDepth 4          // token count, then kEzErrTemplateDepth - 2 leading tokens
+#endif
+
+#ifndef kEzErrTemplateSimilarity
+#define kEzErrTemplateSimilarity 0.5   // share of tokens a detail must have in common with a template to join it
+#endif
+
+#ifdef __OBJC__
+static NSString * const kEzErrTemplateIDKey    = @"kEzErrTemplateIDKey"; //NSNumber
+static NSString * const kEzErrTemplateKey      = @"kEzErrTemplateKey"; //NSString, variable tokens shown as <*>
+static NSString * const kEzErrTemplateCountKey = @"kEzErrTemplateCountKey"; //NSNumber, details matched
+
+static inline void ezErrSetTemplateMining(BOOL on);
+static inline NSArray *ezErrTemplates(void);
+#endif
+
+
+// MARK: - Anomalies
+
+/* ezErr keeps an exponentially weighted mean and variance of the errors per second in each domain and at each call site.
+ * When the current second's count rises more than kEzErrAnomalySigma standard deviations above the mean, ezErr reports one
+ * kEzErrSelfDomainRateAnomaly or kEzErrSelfSiteRateAnomaly error, logged and posted like any other.
+ * It won't report that domain or site again until a second passes back under the threshold.
+ * The detectors are updated by the reports themselves: O(1), lock-free, and no timers.
+ **/
+
+#ifndef kEzErrAnomalySigma
+#define kEzErrAnomalySigma 4.0
+#endif
+
+// Anomaly userInfo keys
+#ifdef __OBJC__
+static NSString * const kEzErrAnomalyRateKey = @"kEzErrAnomalyRateKey"; //NSNumber, errors in the current second
+static NSString * const kEzErrAnomalyMeanKey = @"kEzErrAnomalyMeanKey"; //NSNumber, errors per second, weighted mean
+static NSString * const kEzErrAnomalySigmaKey = @"kEzErrAnomalySigmaKey"; //NSNumber, standard deviation
+#endif
+
+
+// MARK: - Distinct errors
+
+/* ezErrCardinalityWindow(int windowsAgo, ezErrCardinality *)
+ *
+ * Estimates how many distinct kinds of error, (site, domain, code), and how many distinct detail strings
+ * were reported in a window of kEzErrCardinalityWindow seconds. 0 is the current window, 1 the one before it.
+ * Passes back NO if that window has no data.
+ * A sudden jump in distinct kinds is the quickest sign of a new failure mode.
+ *
+ * The sketches are HyperLogLog (about 3% error) and cost one register max per event.
+ * ezErrHLLMerge combines sketches, for instance ones sent from several processes. Their registers are plain bytes.
+ **/
+
+#ifndef kEzErrCardinalityWindow
+#define kEzErrCardinalityWindow 60
+#endif
+
+#define kEzErrHLLPrecision 10
+#define kEzErrHLLRegisters (1 << kEzErrHLLPrecision)
+
+typedef struct {
+    uint8_t registers[kEzErrHLLRegisters];
+} ezErrHLL;
+
+typedef struct {
+    uint64_t startNanos;   // monotonic time the window began
+    ezErrHLL kinds;        // (site, domain, code)
+    ezErrHLL details;      // detail strings
+    double   distinctKinds;
+    double   distinctDetails;
+} ezErrCardinality;
+
+static inline BOOL ezErrCardinalityWindow(int windowsAgo, ezErrCardinality *cardinality);
+static inline double ezErrHLLEstimate(const ezErrHLL *hll);
+static inline void ezErrHLLMerge(ezErrHLL *into, const ezErrHLL *from);
+
+/* Example use for ezErrCardinalityWindow
+
+ ezErrCardinality now, before;
+ if (ezErrCardinalityWindow(0, &now) && ezErrCardinalityWindow(1, &before) && now.distinctKinds > 2 * before.distinctKinds) {
+     NSLog(@"New kinds of error are showing up");
+ }
+*/
+
+
+// MARK: - Statistics
+
+/* ezErrStatsSnapshot(ezErrStats *)
+ *
+ * Copies every ezErr statistic into stats as one consistent view, for dashboards and periodic reports.
+ * Reporting threads never wait on a snapshot. The copy is retried only if an error is reported while it is being taken,
+ * and only so many times: under a storm that never lets up, the last copy is passed back with torn set, its fields
+ * each right but possibly a report or two apart.
+ * Top domains are sorted most frequent first. Domain names stay valid for the life of the process.
+ **/
+
+#define kEzErrStatsTopDomains 8
+
+typedef enum {
+    kEzErrFlushImmediate, // quiet: each log is written as soon as it arrives
+    kEzErrFlushBatched,   // storm: logs are grouped into larger, less frequent writes
+} ezErrFlushMode;
+
+typedef struct {
+    const char *domain;
+    uint64_t    count;
+    double      distinctKinds; // estimated distinct (site, code) pairs in this domain in the current cardinality window
+} ezErrDomainCount;
+
+typedef struct {
+    uint64_t writes;
+    uint64_t errors;
+    uint64_t lastLatencyNanos;
+    uint64_t maxLatencyNanos;
+} ezErrSinkStats;
+
+typedef struct {
+    uint64_t count;            // errors reported since launch
+    uint64_t mainThreadCount;  // errors reported on the main thread
+    uint64_t firstNanos;       // monotonic time of the first error, 0 if none yet
+    uint64_t lastNanos;        // monotonic time of the latest error
+    double   ratePerSecond;    // count over the span between first and latest error
+    uint64_t otherDomainCount; // errors whose domain didn't fit in the domain table
+    uint64_t queueDepth;       // logs waiting for the writer
+    ezErrFlushMode flushMode;  // the writer's latest choice
+    uint64_t batchTarget;      // batch size the writer is currently aiming for
+    uint64_t lastBatchSize;
+    uint64_t maxBatchSize;
+    uint64_t flushCount;
+    ezErrSinkStats fileSink;
+    ezErrSinkStats fallbackSink;
+    BOOL     failedOver;       // logs are going to the fallback sink
+    uint64_t memoryBudget;
+    uint64_t memoryUsage[kEzErrMemoryComponentCount]; // bytes
+    uint64_t droppedLogs;      // logs dropped to stay under the memory budget
+    uint64_t repeats;          // reports folded into a repeat summary instead of logged
+    int      topDomainCount;
+    ezErrDomainCount topDomains[kEzErrStatsTopDomains];
+    BOOL     torn;             // reports kept landing while this was copied; fields may disagree by a few reports
+} ezErrStats;
+
+static inline void ezErrStatsSnapshot(ezErrStats *stats);
+
+/* Example use for ezErrStatsSnapshot
+
+ ezErrStats stats;
+ ezErrStatsSnapshot(&stats);
+ NSLog(@"%llu errors, %.2f/s, most from %s", stats.count, stats.ratePerSecond, stats.topDomainCount ? stats.topDomains[0].domain : "nowhere");
+*/
+
+
+// MARK: - Error budgets
+
+/* ezErrRegisterSLO(NSString *domain, double maxErrorRatio)
+ *
+ * Registers a service level objective for a domain, e.g. 0.001 for "at most 0.1% of operations fail".
+ * Every error ezErr reports in that domain counts as a failed operation. Call ezErrSLOSuccess for each operation that succeeds.
+ * Passes back NULL if kEzErrMaxSLOs are already registered. Registering a domain twice passes back the same SLO.
+ **/
+
+#define kEzErrMaxSLOs 16
+
+typedef struct _as_slo ezErrSLO;
+
+#ifdef __OBJC__
+static inline ezErrSLO *ezErrRegisterSLO(NSString *domain, double maxErrorRatio);
+#endif
+
+/* ezErrSLOSuccess(ezErrSLO *)
+ *
+ * Counts one successful operation. Meant for the hot path: a single relaxed add to a per-thread shard.
+ **/
+
+static inline void ezErrSLOSuccess(ezErrSLO *slo);
+
+/* ezErrSLOStatusGet(ezErrSLO *, ezErrSLOStatus *)
+ *
+ * Fills in the error ratio and burn rate over the last 5 minutes, hour and 6 hours.
+ * A burn rate of 1 spends the error budget exactly as fast as the objective allows; alert on fast burns in short windows
+ * and on slow burns in long ones. Windows reach back at most to the first error or status check after registering.
+ **/
+
+typedef enum {
+    kEzErrSLOWindow5Minutes,
+    kEzErrSLOWindow1Hour,
+    kEzErrSLOWindow6Hours,
+    kEzErrSLOWindowCount
+} ezErrSLOWindow;
+
+typedef struct {
+    uint64_t successes;   // since registering
+    uint64_t errors;
+    double   errorRatio[kEzErrSLOWindowCount];
+    double   burnRate[kEzErrSLOWindowCount];
+} ezErrSLOStatus;
+
+static inline void ezErrSLOStatusGet(ezErrSLO *slo, ezErrSLOStatus *status);
+
+/* Example use for error budgets
+
+ static ezErrSLO *uploads;
+ uploads = ezErrRegisterSLO(@"UploadErrorDomain", 0.001);
+
+ if (! ezErr(error, @"Upload failed")) ezErrSLOSuccess(uploads);
+
+ ezErrSLOStatus status;
+ ezErrSLOStatusGet(uploads, &status);
+ if (status.burnRate[kEzErrSLOWindow5Minutes] > 14 && status.burnRate[kEzErrSLOWindow1Hour] > 14) page();
+*/
+
+
+// MARK: - Classification
+
+/* ezErrClassification({domain, code, class}, ...)
+ *
+ * Declares how errors are handled, by domain and code, in one table instead of if/else chains on error.domain.
+ * Objective-C++ (C++14) only, and once per app, at file scope in any .mm file. The table is compiled into a perfect hash;
+ * looking an error up hashes its domain once and compares two integers, never strings.
+ * Domains must be C string literals. kEzErrAnyCode matches every code in a domain not listed with its own code.
+ * Every reported error carries its class in the log and under kEzErrClassKey, and can be queried from Objective-C too.
+ **/
+
+typedef enum {
+    kEzErrClassUnknown,    // not in the table
+    kEzErrClassRetryable,  // try again, e.g. after backing off
+    kEzErrClassTransient,  // goes away on its own; retrying is fine
+    kEzErrClassFatal,      // retrying won't help
+    kEzErrClassUserFacing, // show it to the user
+} ezErrClass;
+
+#define kEzErrAnyCode INT64_MIN
+
+/* ezErrClassOf(NSError *)
+ *
+ * Passes back the error's ezErrClass, or kEzErrClassUnknown for nil or unlisted errors.
+ **/
+
+#define ezErrClassOf(error)\
+_as_errorClass(error)
+
+/* ezErrRetryable(NSError *)
+ *
+ * Passes back YES if the error's class is kEzErrClassRetryable or kEzErrClassTransient.
+ **/
+
+#define ezErrRetryable(error)\
+_as_retryable(_as_errorClass(error))
+
+/* Example use for ezErrClassification
+
+ // Classification.mm
+ ezErrClassification({"NSURLErrorDomain", NSURLErrorTimedOut, kEzErrClassTransient},
+                     {"NSURLErrorDomain", NSURLErrorNotConnectedToInternet, kEzErrClassUserFacing},
+                     {"NSURLErrorDomain", kEzErrAnyCode, kEzErrClassRetryable},
+                     {"NSCocoaErrorDomain", NSFileNoSuchFileError, kEzErrClassFatal});
+
+ // Anywhere
+ if (ezErrRetryable(error)) [self scheduleRetry];
+*/
+
+
+// MARK: - ezErrRetry(detail, operation, completion)
+
+/* ezErrRetry(NSString *, ezErrRetryOperation, ezErrRetryCompletion)
+ *
+ * Runs operation, and if it finishes with an error, logs the error with its attempt number and runs it again later.
+ * Retries back off exponentially with full jitter, from kEzErrRetryBaseDelay up to kEzErrRetryMaxDelay seconds,
+ * so a fleet of failing clients doesn't retry in lockstep. Retries are timers, not sleeping threads.
+ * Gives up after kEzErrRetryMaxAttempts attempts, or right away if the error's ezErrClass is fatal or user facing.
+ * completion gets nil on success or the last error. Retries run on a background queue.
+ **/
+
+#ifndef kEzErrRetryMaxAttempts
+#define kEzErrRetryMaxAttempts 5
+#endif
+
+#ifndef kEzErrRetryBaseDelay
+#define kEzErrRetryBaseDelay 0.1
+#endif
+
+#ifndef kEzErrRetryMaxDelay
+#define kEzErrRetryMaxDelay 30.0
+#endif
+
+#ifdef __OBJC__
+typedef void (^ezErrRetryDone)(NSError *error);
+typedef void (^ezErrRetryOperation)(NSUInteger attempt, ezErrRetryDone done);
+typedef void (^ezErrRetryCompletion)(NSError *error);
+
+// Variadic so commas inside the blocks don't split the macro arguments
+#define ezErrRetry(detail, ...)\
+_as_retry(__FILE__, __FUNCTION__, __LINE__, detail, __VA_ARGS__)
+#endif
+
+/* Example use for ezErrRetry
+
+ [DatabaseAPI fetchTumBookInfoWithCallback:^(NSError *err)
+ {
+     // Log this failure, then retry in the background and report the outcome to authCallback
+     ezErrBlockReturn(err, @"TumBook info from cache",
+                      ezErrRetry(@"TumBook info", ^(NSUInteger attempt, ezErrRetryDone done) {
+                          [DatabaseAPI fetchTumBookInfoWithCallback:done];
+                      }, ^(NSError *finalError) {
+                          authCallback(finalError, finalError == nil);
+                      }));
+     //...
+ }];
+*/
+
+
+// MARK: - ezErrBatch(errors, detail)
+
+/* ezErrBatch(id<NSFastEnumeration>, NSString *)
+ *
+ * ezErr for every NSError in a collection, such as the errors a batch write or a fan-out hands back.
+ * Anything that isn't an NSError (nil placeholders, NSNull) is skipped. The site is captured once,
+ * and all the logs go to the writer in one reservation. Passes back the number of errors found.
+ **/
+
+#define ezErrBatch(errors, detail)\
+({ NSUInteger _as_failures; @autoreleasepool { _as_failures = _as_logErrBatch(errors, detail, __FILE__, __FUNCTION__, __LINE__); } _as_failures; })
+
+/* Example use for ezErrBatch
+
+ [store saveObjects:objects completion:^(NSArray *errors) {
+     if (ezErrBatch(errors, @"Batch save") > 0) [self scheduleResync];
+ }];
+*/
+
+
+// MARK: - Request scopes
+
+/* ezErrScopeBegin(NSString *name)
+ *
+ * One failing request often trips ezErr at several layers. Errors reported inside ezErrScopeRun are still counted and
+ * posted one by one, but their logs are collected and written as one record when the scope ends: the scope's name,
+ * then each error in order with its time since the scope began. Runs nest; errors go to the innermost scope.
+ * At most kEzErrScopeMaxErrors errors are listed per record, the rest are only counted.
+ * Errors whose ezErrClass is in the scope's flush classes (ezErrScopeSetFlushClasses, default fatal) write the record
+ * right away, so they are never held back. Collection carries on afterwards.
+ *
+ * ezErrScopeRun(ezErrScope *, block) runs block with the scope current. A scope is only ever current inside a run,
+ * on the run's thread, so it can be begun on one thread and ended from a callback on another.
+ * ezErrScopeEnd(ezErrScope *) writes what's left and frees the scope. Call it once every run has returned, or as the
+ * last thing inside one, and don't use the scope afterwards.
+ * ezErrScopeBegin passes back NULL if it can't allocate. The other scope functions take NULL, and errors then log one by one.
+ **/
+
+#ifndef kEzErrScopeMaxErrors
+#define kEzErrScopeMaxErrors 32
+#endif
+
+typedef struct _as_scope ezErrScope;
+
+#define ezErrClassMask(errorClass) (1u << (errorClass))
+
+#ifdef __OBJC__
+static inline ezErrScope *ezErrScopeBegin(NSString *name);
+static inline void ezErrScopeSetFlushClasses(ezErrScope *scope, uint32_t classMask);
+static inline void ezErrScopeRun(ezErrScope *scope, dispatch_block_t block);
+static inline void ezErrScopeEnd(ezErrScope *scope);
+#endif
+
+/* Example use for request scopes
+
+ ezErrScope *scope = ezErrScopeBegin([NSString stringWithFormat:@"GET %@", url.path]);
+ ezErrScopeSetFlushClasses(scope, ezErrClassMask(kEzErrClassFatal) | ezErrClassMask(kEzErrClassUserFacing));
+ ezErrScopeRun(scope, ^{
+     ezErr([self validate:url], @"Validate");
+ });
+ [client fetch:url completion:^(NSData *data, NSError *error) {
+     ezErrScopeRun(scope, ^{
+         ezErr(error, @"Fetch");
+         ezErr([self parse:data], @"Parse");
+     });
+     ezErrScopeEnd(scope);
+ }];
+*/
+
+
+// MARK: - ezErrF(error, format, ...)
+
+/* ezErrF(NSError *, "format", ...)
+ *
+ * ezErr with a std::format style detail, for Objective-C++ built as C++14 or later.
+ * Each {} in format is replaced by the next argument, {{ and }} are literal braces.
+ * format has to be a string literal. Unmatched braces, or a placeholder count that doesn't match the arguments, fail to compile.
+ * Arguments can be numbers, bools, enums, C strings, std::strings and Objective-C objects.
+ * They are copied (objects are retained) and the detail is rendered on the writer queue, not on the calling thread.
+ * Distinct details are counted by format, and the notification is posted from a background queue.
+ **/
+
+#define ezErrF(error, format, ...)\
+(_as_isError(error) ? (_as_checkFormat(format, ##__VA_ARGS__), ({ @autoreleasepool { _as_logErrFormat(error, "" format, __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); } }), YES) : NO)
+
+/* ezErrFReturn(NSError *, "format", ...)
+ *
+ * The ezErrF version of ezErrReturn.
+ **/
+
+#define ezErrFReturn(error, format, ...)\
+if (ezErrF(error, format, ##__VA_ARGS__)){\
+return;\
+}
+
+/* Example use for ezErrF
+
+ [session dataTaskWithURL:url completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+     ezErrFReturn(error, "Fetch {} failed after {} bytes, attempt {}", url, data.length, attempt);
+     //...
+ }];
+*/
+
+
+// MARK: - C API
+
+/* ezerr_report(const ezerr_site *, int64_t code, const char *domain, const char *detail, size_t len)
+ *
+ * Reports an error from C or C++ with no Foundation and no allocation on the calling thread.
+ * The report is copied into a fixed ring and goes through the same pipeline as ezErr (log, statistics, notification)
+ * on a background queue. Domain is cut at 63 bytes and detail at kEzErrCDetailMax - 1, short of any UTF-8 character
+ * that would be split.
+ * If the ring is full the report is counted in ezErrStats.droppedLogs.
+ * The ring is drained by Objective-C, so at least one .m file in the process has to import ezErr.h.
+ **/
+
+#ifndef kEzErrCDetailMax
+#define kEzErrCDetailMax 256
+#endif
+
+typedef struct {
+    const char *file;
+    const char *function;
+    int         line;
+} ezerr_site;
+
+static inline void ezerr_report(const ezerr_site *site, int64_t code, const char *domain, const char *detail, size_t len);
+
+/* ezerr(int64_t code, const char *domain, const char *detail)
+ *
+ * The C ezErr. A code of 0 is success.
+ * If code is 0, passes back false and does nothing else.
+ * If not, reports it and passes back true.
+ **/
+
+#define ezerr(code, domain, detail)\
+_as_ezerr(_as_site(), (int64_t)(code), domain, detail)
+
+/* ezerr_batch(const int64_t *codes, size_t count, const char *domain, const char *detail)
+ *
+ * Reports every nonzero code in codes, from one site, claiming ring slots for all of them at once.
+ * In C++ codes can be any container of integers instead: ezerr_batch(codes, domain, detail).
+ * Passes back the number of nonzero codes. Reports that don't fit in the ring are counted in ezErrStats.droppedLogs.
+ **/
+
+#define ezerr_batch(...)\
+_as_ezerrBatch(_as_site(), __VA_ARGS__)
+
+/* ezerr_return(int64_t code, const char *domain, const char *detail)
+ *
+ * The C ezErrReturn. If code isn't 0, reports it and calls return on the original function.
+ **/
+
+#define ezerr_return(code, domain, detail)\
+if (ezerr(code, domain, detail)){\
+return;\
+}
+
+/* Example use for the C API
+
+ int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+ ezerr_return(rc, "SQLite", sqlite3_errmsg(db));
+
+ int64_t results[64];
+ size_t failed = ezerr_batch(results, 64, "Upload", "Chunk upload");
+*/
+
+
+// MARK: - Events
+
+/* ezErrEventEncode(const ezErrEvent *, uint8_t *buffer, size_t capacity)
+ *
+ * Writes one event as CBOR (RFC 8949) into buffer, for local collectors, archives and replay tools.
+ * Passes back the number of bytes written, or 0 if the event doesn't fit. Never allocates.
+ * An event is a map with ezErrEventKey keys, inside the self-described CBOR tag (55799) so a stream of events
+ * can be recognized. Readers skip keys they don't know, so keys can be added without breaking old readers.
+ **/
+
+typedef enum {
+    kEzErrEventVersion,      // 1
+    kEzErrEventDetail,       // text
+    kEzErrEventFile,         // text
+    kEzErrEventFunction,     // text
+    kEzErrEventLine,         // integer
+    kEzErrEventMainThread,   // bool
+    kEzErrEventDate,         // double, seconds since 1970
+    kEzErrEventDomain,       // text
+    kEzErrEventCode,         // integer
+    kEzErrEventClass,        // integer, an ezErrClass
+    kEzErrEventFirstSeen,    // bool
+    kEzErrEventUnderlying,   // array of [domain, code], outermost first
+    kEzErrEventUserInfo,     // map of the allowed userInfo entries, see User info. Optional.
+} ezErrEventKey;
+
+#define kEzErrEventTag 55799
+
+#ifndef kEzErrEventMaxUnderlying
+#define kEzErrEventMaxUnderlying 4
+#endif
+
+#if kEzErrEventMaxUnderlying > 23
+#error kEzErrEventMaxUnderlying has to fit a one byte CBOR header (at most 23)
+#endif
+
+// Text that isn't NUL terminated
+typedef struct {
+    const char *bytes;
+    size_t      length;
+} ezErrString;
+
+typedef struct {
+    ezErrString domain;
+    int64_t     code;
+} ezErrUnderlying;
+
+typedef struct {
+    ezErrString     detail;
+    ezErrString     file;
+    ezErrString     function;
+    int64_t         line;
+    BOOL            onMainThread;
+    double          date;
+    ezErrString     domain;
+    int64_t         code;
+    ezErrClass      errorClass;
+    BOOL            firstSeen;
+    ezErrUnderlying underlying[kEzErrEventMaxUnderlying];
+    size_t          underlyingCount;
+    const uint8_t  *userInfo; // CBOR map, or NULL
+    size_t          userInfoLength;
+} ezErrEvent;
+
+static inline size_t ezErrEventEncode(const ezErrEvent *event, uint8_t *buffer, size_t capacity);
+
+/* ezErrEventDecode(const uint8_t *bytes, size_t length, ezErrEvent *)
+ *
+ * Reads the event at the start of bytes. Passes back the number of bytes it took, or 0 if they aren't an event.
+ * Strings and userInfo point into bytes. Underlying errors past kEzErrEventMaxUnderlying are skipped.
+ **/
+
+static inline size_t ezErrEventDecode(const uint8_t *bytes, size_t length, ezErrEvent *event);
+
+/* ezErrEventEncodeInfo(NSDictionary *, uint8_t *buffer, size_t capacity)
+ *
+ * Encodes the userInfo of a kEzErrNotification directly, walking kEzErrErrorKey for the underlying errors and
+ * the allowed userInfo entries. Like ezErrEventEncode, passes back the bytes written or 0.
+ **/
+
+#ifdef __OBJC__
+static inline size_t ezErrEventEncodeInfo(NSDictionary *errorInfo, uint8_t *buffer, size_t capacity);
+#endif
+
+/* Example use for events
+
+ [[NSNotificationCenter defaultCenter] addObserverForName:kEzErrNotification object:nil queue:nil usingBlock:^(NSNotification *note) {
+     uint8_t buffer[4096];
+     size_t length = ezErrEventEncodeInfo(note.userInfo, buffer, sizeof buffer);
+     if (length) write(archive, buffer, length);
+ }];
+
+ // Replay
+ ezErrEvent event;
+ for (size_t used; (used = ezErrEventDecode(bytes, length, &event)); bytes += used, length -= used) {
+     printf("%.*s:%lld %.*s\n", (int)event.file.length, event.file.bytes, event.line, (int)event.detail.length, event.detail.bytes);
+ }
+*/
+
+/* ezErrEventStreamEncode(ezErrEventStream *, const ezErrEvent *, uint8_t *buffer, size_t capacity)
+ *
+ * Writes an event into a stream that is read back in order, such as an archive file. Consecutive events from one site
+ * (file and line) usually differ only in date and a field or two. A site's first event is a keyframe, written as by
+ * ezErrEventEncode. The events after it are delta records: a CBOR byte string holding the site's slot, a bitmask of
+ * the fields that changed, and only those fields, with numbers as varint deltas. A repeat that differs only in date
+ * takes 6 or 7 bytes. Every kEzErrEventKeyframeInterval events a site gets a keyframe again, so a reader that starts
+ * partway through catches up.
+ * Dates in delta records are kept to the microsecond. Sites share kEzErrEventStreamSites slots, and a site that takes
+ * over a slot starts with a keyframe. The encoder compares text by 64-bit hashes, so it keeps no copies.
+ * Zero the stream before the first event. Passes back the bytes written, or 0 if the record doesn't fit.
+ *
+ * ezErrEventStreamDecode(ezErrEventStream *, const uint8_t *bytes, size_t length, ezErrEvent *)
+ *
+ * Reads the next event of a stream into event, using a zeroed ezErrEventStream of its own. Delta records for sites
+ * without a keyframe yet are stepped over. Passes back the bytes it took, or 0 at the end or if the bytes aren't a stream.
+ * Strings point into bytes, including bytes of earlier records, so keep the stream in memory while reading it.
+ **/
+
+#ifndef kEzErrEventStreamSites
+#define kEzErrEventStreamSites 64
+#endif
+
+#ifndef kEzErrEventKeyframeInterval
+#define kEzErrEventKeyframeInterval 64
+#endif
+
+typedef struct {
+    struct {
+        uint64_t   site;      // 0 when empty
+        uint32_t   deltas;    // since the site's keyframe
+        ezErrEvent last;      // the encoder only uses the numbers
+        uint64_t   hashes[kEzErrEventUserInfo + 1]; // encoder only, by ezErrEventKey
+    } sites[kEzErrEventStreamSites]; // private
+} ezErrEventStream;
+
+static inline size_t ezErrEventStreamEncode(ezErrEventStream *stream, const ezErrEvent *event, uint8_t *buffer, size_t capacity);
+static inline size_t ezErrEventStreamDecode(ezErrEventStream *stream, const uint8_t *bytes, size_t length, ezErrEvent *event);
+
+/* Example use for event streams
+
+ static ezErrEventStream archiveStream; // writer side, zeroed
+
+ uint8_t buffer[4096];
+ size_t length = ezErrEventStreamEncode(&archiveStream, &event, buffer, sizeof buffer);
+ if (length) write(archive, buffer, length);
+
+ // Replay, from a mapped file
+ ezErrEventStream *stream = calloc(1, sizeof *stream);
+ for (size_t used; (used = ezErrEventStreamDecode(stream, bytes, length, &event)); bytes += used, length -= used) {
+     ...
+ }
+ free(stream);
+*/
+
+
+// MARK: - Log blocks
+
+/* ezErrSetLogFileBlocks(BOOL)
+ *
+ * Frames each write to the log file as a block: kEzErrBlockMagic, the payload length, the CRC32C of both, then the
+ * payload (the logs of one batch). A crash or power loss can leave half a write at the end of the file; ezErrBlockNext
+ * steps over torn and corrupted blocks instead of handing a parser half a log. Set it before ezErrSetLogFile.
+ * Off by default, so log files stay plain text.
+ *
+ * ezErrBlockHeader(const void *payload, size_t length, uint8_t *header)
+ *
+ * Fills in the kEzErrBlockHeaderSize byte header for a payload, to frame your own files (such as event streams) the same way.
+ * Write the header and payload in one write.
+ *
+ * ezErrBlockNext(const uint8_t *bytes, size_t length, size_t *offset, ezErrString *payload)
+ *
+ * Finds the next good block at or after *offset, passes back its payload and moves *offset past it. Bad blocks are
+ * skipped by looking for the next kEzErrBlockMagic that starts a block whose checksum holds, so a damaged block costs
+ * only itself and reading never restarts from the top. Passes back NO when no good block is left, with *offset
+ * unchanged: after the last good block, where a recovering writer can truncate a torn tail.
+ *
+ * ezErrCRC32C(uint32_t crc, const void *bytes, size_t length)
+ *
+ * CRC32C (Castagnoli), 0 to start, chainable. Uses the SSE4.2 or ARMv8 CRC instructions where the CPU has them.
+ **/
+
+#define kEzErrBlockMagic      0x31427A65u // "ezB1", little endian
+#define kEzErrBlockHeaderSize 12          // magic, length and CRC32C, each 32 bits little endian
+
+static inline uint32_t ezErrCRC32C(uint32_t crc, const void *bytes, size_t length);
+static inline void ezErrBlockHeader(const void *payload, size_t length, uint8_t *header);
+static inline BOOL ezErrBlockNext(const uint8_t *bytes, size_t length, size_t *offset, ezErrString *payload);
+
+#ifdef __OBJC__
+static inline void ezErrSetLogFileBlocks(BOOL on);
+#endif
+
+/* Example use for log blocks
+
+ ezErrSetLogFileBlocks(YES);
+ ezErrSetLogFile(path);
+
+ // Reading it back after a crash
+ size_t offset = 0;
+ ezErrString payload;
+ while (ezErrBlockNext(bytes, length, &offset, &payload)) {
+     fwrite(payload.bytes, 1, payload.length, stdout);
+ }
+ if (offset < length) ftruncate(fd, offset); // a torn tail
+*/
+
+
+/////////////////////////////////////////////////////////////////
+// Anything below this line is not intended to be used directly.
+
+// MARK: - Internal methods
+
+#ifdef __OBJC__
+// The one error check every macro goes through. Each invocation checks exactly once; _as_logErr trusts it.
+static inline BOOL _as_isError(id error)
+{
+    return [error isKindOfClass:[NSError class]] && [error domain];
+}
+
+#ifdef __cplusplus
+// In Objective-C++ an argument statically typed as NSError * (or a subclass) skips the dynamic class check.
+static inline BOOL _as_isError(NSError *error)
+{
+    return error.domain != nil;
+}
+
+// A literal nil would otherwise be ambiguous between the two overloads above.
+static inline BOOL _as_isError(decltype(nullptr))
+{
+    return NO;
+}
+#endif
+
+// Gathers info about the error method and passes it to logging function.
+// Reporting runs in its own autorelease pool, so errors in a long loop or a poolless thread don't pile up garbage.
+#define _as_convertForLog(error, summary)\
+({ @autoreleasepool { _as_logErrAt(error, summary, __FILE__, __FUNCTION__, __LINE__); } })
+#endif
+
+
+// MARK: - Internal statistics
+
+// Shared across every file that imports ezErr.h: the linker keeps one copy of each weak definition.
+#define _as_shared __attribute__((weak))
+
+// Hashes are also computed at compile time for classification tables
+#if defined(__cplusplus) && __cplusplus >= 201402L
+#define _as_constexpr constexpr
+#else
+#define _as_constexpr
+#endif
+
+// Strict ISO modes (-std=c11 rather than gnu11) hide POSIX, see Requirements. There's no falling back to C11's timespec_get:
+// windows, rates and deadlines are shared by every file in the process, and a wall clock that steps would skew them all.
+#if !defined(CLOCK_MONOTONIC)
+#error ezErr.h needs CLOCK_MONOTONIC: build with a GNU dialect (-std=gnu11) or define _POSIX_C_SOURCE=200809L
+#endif
+
+static inline uint64_t _as_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// FNV-1a. Never returns 0, which marks an empty slot.
+static inline _as_constexpr uint64_t _as_hash(const char *bytes, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash ? hash : 1;
+}
+
+// splitmix64 finalizer, for combining hashes and spreading FNV's bits before HyperLogLog uses them
+static inline _as_constexpr uint64_t _as_mix(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline uint64_t _as_siteHash(const char *file, int line)
+{
+    return _as_mix(_as_hash(file, strlen(file)) ^ (uint64_t)line);
+}
+
+static inline _as_constexpr uint64_t _as_classKey(uint64_t domainHash, int64_t code)
+{
+    return _as_mix(domainHash ^ _as_mix((uint64_t)code));
+}
+
+// Identifies a kind of error: where it was reported, and its domain and code
+static inline uint64_t _as_fingerprint(uint64_t siteHash, uint64_t domainHash, int64_t code)
+{
+    return _as_mix(_as_mix(siteHash ^ domainHash) ^ (uint64_t)code);
+}
+
+#define _as_kDomainSlots 64
+
+typedef struct {
+    uint64_t    hash;
+    const char *name;
+    uint64_t    count;
+} _as_domainSlot;
+
+// Writers bump begin on their thread's stripe, update fields with atomic adds, then bump end. Nobody ever waits on a writer.
+// A reader whose copy overlapped a writer sees some stripe's begin move (or begin != end) and copies again.
+// Each stripe has its own cache line, so threads reporting at once don't all bounce one line between them.
+#define _as_kStatsStripes 16
+
+typedef struct {
+    uint64_t begin;
+    uint64_t end;
+} __attribute__((aligned(64))) _as_statsStripe;
+
+typedef struct {
+    uint64_t count;
+    uint64_t mainThreadCount;
+    uint64_t firstNanos;
+    uint64_t lastNanos;
+    uint64_t otherDomainCount;
+    _as_domainSlot domains[_as_kDomainSlots];
+
+    // Writer side. depth is bumped by reporters, everything else only on the writer queue.
+    uint64_t queueDepth;
+    uint64_t oldestNanos;
+    uint64_t flushMode;
+    uint64_t batchTarget;
+    uint64_t lastBatchSize;
+    uint64_t maxBatchSize;
+    uint64_t flushCount;
+
+    ezErrSinkStats fileSink;
+    ezErrSinkStats fallbackSink;
+    uint64_t failedOver;
+    uint64_t fileWriteStartNanos; // nonzero while a file write is in progress
+    uint64_t fileErrorsInARow;
+
+    uint64_t memoryUsage[kEzErrMemoryComponentCount];
+    uint64_t droppedLogs;
+    uint64_t reclaimPending; // bytes a queued reclaim pass will free
+    uint64_t repeats;
+} _as_stats_t;
+
+_as_shared _as_stats_t _as_stats;
+_as_shared _as_statsStripe _as_statsStripes[_as_kStatsStripes];
+_as_shared uint32_t _as_statsThreads;
+_as_shared __thread uint32_t _as_statsThread; // 1 + this thread's stripe, 0 until its first write
+
+static inline _as_statsStripe *_as_statsBegin(void)
+{
+    if (!_as_statsThread) _as_statsThread = 1 + __atomic_fetch_add(&_as_statsThreads, 1, __ATOMIC_RELAXED) % _as_kStatsStripes;
+    _as_statsStripe *stripe = &_as_statsStripes[_as_statsThread - 1];
+    __atomic_fetch_add(&stripe->begin, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return stripe;
+}
+
+static inline void _as_statsEnd(_as_statsStripe *stripe)
+{
+    __atomic_fetch_add(&stripe->end, 1, __ATOMIC_RELEASE);
+}
+
+// MARK: - Internal memory accounting
+
+_as_shared uint64_t _as_memoryBudget = kEzErrDefaultMemoryBudget;
+
+static inline void ezErrSetMemoryBudget(size_t bytes)
+{
+    __atomic_store_n(&_as_memoryBudget, (uint64_t)bytes, __ATOMIC_RELAXED);
+}
+
+static inline void _as_memoryCharge(ezErrMemoryComponent component, uint64_t bytes)
+{
+    __atomic_fetch_add(&_as_stats.memoryUsage[component], bytes, __ATOMIC_RELAXED);
+}
+
+static inline void _as_memoryRelease(ezErrMemoryComponent component, uint64_t bytes)
+{
+    __atomic_fetch_sub(&_as_stats.memoryUsage[component], bytes, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t _as_memoryTotal(void)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < kEzErrMemoryComponentCount; i++) {
+        total += __atomic_load_n(&_as_stats.memoryUsage[i], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+
+// MARK: - Internal classification
+
+// Hash and displace: a key's bucket picks a seed, and the seed places the key in a slot no other key uses.
+// A lookup is two array reads plus one comparison of the full key to reject errors that aren't in the table.
+typedef struct {
+    uint64_t key;  // _as_classKey, 0 if empty
+    int      errorClass;
+} _as_classSlot;
+
+typedef struct {
+    uint64_t bucketMask;
+    uint64_t slotMask;
+    const uint32_t *seeds;
+    const _as_classSlot *slots;
+} _as_classifier_t;
+
+_as_shared const _as_classifier_t *_as_classifier;
+
+static inline _as_constexpr uint64_t _as_classSlotIndex(uint64_t key, uint32_t seed, uint64_t slotMask)
+{
+    return _as_mix(key ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ull)) & slotMask;
+}
+
+static inline ezErrClass _as_classLookup(const _as_classifier_t *classifier, uint64_t key)
+{
+    uint32_t seed = classifier->seeds[key & classifier->bucketMask];
+    const _as_classSlot *slot = &classifier->slots[_as_classSlotIndex(key, seed, classifier->slotMask)];
+    return slot->key == key ? (ezErrClass)slot->errorClass : kEzErrClassUnknown;
+}
+
+static inline ezErrClass _as_classify(uint64_t domainHash, int64_t code)
+{
+    const _as_classifier_t *classifier = __atomic_load_n(&_as_classifier, __ATOMIC_ACQUIRE);
+    if (!classifier) return kEzErrClassUnknown;
+    ezErrClass errorClass = _as_classLookup(classifier, _as_classKey(domainHash, code));
+    if (errorClass == kEzErrClassUnknown) errorClass = _as_classLookup(classifier, _as_classKey(domainHash, kEzErrAnyCode));
+    return errorClass;
+}
+
+#ifdef __OBJC__
+static inline const char *_as_className(ezErrClass errorClass)
+{
+    static const char *names[] = {"Unknown", "Retryable", "Transient", "Fatal", "User facing"};
+    return (unsigned)errorClass < sizeof names / sizeof names[0] ? names[errorClass] : "Unknown";
+}
+
+static inline ezErrClass _as_classOf(NSError *error)
+{
+    const char *domain = error.domain.UTF8String;
+    return _as_classify(_as_hash(domain, strlen(domain)), error.code);
+}
+
+// Functions rather than macro bodies, so the error expression is evaluated once
+static inline ezErrClass _as_errorClass(id error)
+{
+    return _as_isError(error) ? _as_classOf(error) : kEzErrClassUnknown;
+}
+
+#ifdef __cplusplus
+static inline ezErrClass _as_errorClass(NSError *error)
+{
+    return _as_isError(error) ? _as_classOf(error) : kEzErrClassUnknown;
+}
+
+static inline ezErrClass _as_errorClass(decltype(nullptr))
+{
+    return kEzErrClassUnknown;
+}
+#endif
+
+static inline BOOL _as_retryable(ezErrClass errorClass)
+{
+    return errorClass == kEzErrClassRetryable || errorClass == kEzErrClassTransient;
+}
+#endif
+
+#if defined(__cplusplus) && __cplusplus >= 201402L
+struct ezErrRule {
+    const char *domain;
+    int64_t     code;
+    ezErrClass  errorClass;
+};
+
+static inline constexpr size_t _as_strlen(const char *string)
+{
+    size_t length = 0;
+    while (string[length]) length++;
+    return length;
+}
+
+static inline constexpr uint64_t _as_pow2AtLeast(uint64_t n)
+{
+    uint64_t size = 1;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+template <size_t N>
+struct _as_classTable {
+    static constexpr uint64_t kBuckets = _as_pow2AtLeast(N);
+    static constexpr uint64_t kSlots = _as_pow2AtLeast(2 * N);
+
+    uint32_t seeds[kBuckets];
+    _as_classSlot slots[kSlots];
+
+    constexpr _as_classTable(const ezErrRule (&rules)[N]) : seeds{}, slots{}
+    {
+        uint64_t keys[N] = {};
+        uint64_t bucketSizes[kBuckets] = {};
+        for (size_t i = 0; i < N; i++) {
+            keys[i] = _as_classKey(_as_hash(rules[i].domain, _as_strlen(rules[i].domain)), rules[i].code);
+            // A repeated rule can never be placed; the first one wins
+            for (size_t j = 0; j < i; j++) {
+                if (keys[j] == keys[i]) keys[i] = 0;
+            }
+            if (keys[i]) bucketSizes[keys[i] & (kBuckets - 1)]++;
+        }
+
+        // Place the fullest buckets first, while most slots are still free
+        bool placed[kBuckets] = {};
+        for (uint64_t round = 0; round < kBuckets; round++) {
+            uint64_t bucket = 0, largest = 0;
+            for (uint64_t b = 0; b < kBuckets; b++) {
+                if (!placed[b] && bucketSizes[b] >= largest) { bucket = b; largest = bucketSizes[b]; }
+            }
+            placed[bucket] = true;
+            if (!largest) continue;
+
+            for (uint32_t seed = 0; ; seed++) {
+                uint64_t taken[N] = {};
+                size_t count = 0;
+                bool fits = true;
+                for (size_t i = 0; i < N && fits; i++) {
+                    if (!keys[i] || (keys[i] & (kBuckets - 1)) != bucket) continue;
+                    uint64_t index = _as_classSlotIndex(keys[i], seed, kSlots - 1);
+                    if (slots[index].key) fits = false;
+                    for (size_t t = 0; t < count && fits; t++) {
+                        if (taken[t] == index) fits = false;
+                    }
+                    taken[count++] = index;
+                }
+                if (!fits) continue;
+
+                seeds[bucket] = seed;
+                for (size_t i = 0; i < N; i++) {
+                    if (!keys[i] || (keys[i] & (kBuckets - 1)) != bucket) continue;
+                    _as_classSlot &slot = slots[_as_classSlotIndex(keys[i], seed, kSlots - 1)];
+                    slot.key = keys[i];
+                    slot.errorClass = rules[i].errorClass;
+                }
+                break;
+            }
+        }
+    }
+
+    constexpr _as_classifier_t classifier() const
+    {
+        return {kBuckets - 1, kSlots - 1, seeds, slots};
+    }
+};
+
+static inline int _as_registerClassifier(const _as_classifier_t *classifier)
+{
+    __atomic_store_n(&_as_classifier, classifier, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#define ezErrClassification(...)\
+static constexpr ezErrRule _as_rules[] = {__VA_ARGS__};\
+static constexpr _as_classTable<sizeof(_as_rules) / sizeof(_as_rules[0])> _as_table(_as_rules);\
+static constexpr _as_classifier_t _as_tableClassifier = _as_table.classifier();\
+static const int _as_tableRegistered = _as_registerClassifier(&_as_tableClassifier);
+#endif
+
+
+// MARK: - Internal sketches
+
+typedef struct {
+    uint64_t epoch; // window number + 1, 0 if never used
+    ezErrHLL kinds;
+    ezErrHLL details;
+    ezErrHLL domains[_as_kDomainSlots]; // kinds per domain, parallel to _as_stats.domains
+} _as_window_t;
+
+_as_shared _as_window_t _as_windows[2];
+
+static inline void _as_hllAdd(ezErrHLL *hll, uint64_t hash)
+{
+    uint32_t index = (uint32_t)(hash >> (64 - kEzErrHLLPrecision));
+    uint8_t rank = (uint8_t)__builtin_clzll((hash << kEzErrHLLPrecision) | (1ull << (kEzErrHLLPrecision - 1))) + 1;
+    uint8_t seen = __atomic_load_n(&hll->registers[index], __ATOMIC_RELAXED);
+    while (rank > seen && !__atomic_compare_exchange_n(&hll->registers[index], &seen, rank, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static inline void _as_hllClear(ezErrHLL *hll)
+{
+    for (int i = 0; i < kEzErrHLLRegisters; i++) __atomic_store_n(&hll->registers[i], 0, __ATOMIC_RELAXED);
+}
+
+// The two windows alternate. The first report in a new window clears what is left from two windows ago;
+// a report racing that clear may be lost, which only nudges an estimate.
+static inline _as_window_t *_as_window(uint64_t now)
+{
+    uint64_t epoch = now / ((uint64_t)kEzErrCardinalityWindow * 1000000000ull) + 1;
+    _as_window_t *window = &_as_windows[epoch & 1];
+    uint64_t seen = __atomic_load_n(&window->epoch, __ATOMIC_ACQUIRE);
+    if (seen != epoch && __atomic_compare_exchange_n(&window->epoch, &seen, epoch, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (seen == 0) _as_memoryCharge(kEzErrMemorySketches, sizeof(_as_window_t));
+        _as_hllClear(&window->kinds);
+        _as_hllClear(&window->details);
+        for (int i = 0; i < _as_kDomainSlots; i++) _as_hllClear(&window->domains[i]);
+    }
+    return window;
+}
+
+
+// MARK: - Internal first-occurrence filter
+
+#define _as_kBloomBits   (1 << 16)
+#define _as_kBloomProbes 4
+
+typedef struct {
+    uint64_t epoch; // period number + 1, 0 if never used
+    uint64_t words[_as_kBloomBits / 64];
+} _as_bloom_t;
+
+_as_shared _as_bloom_t _as_blooms[2];
+
+static inline BOOL _as_bloomContains(_as_bloom_t *bloom, uint64_t fingerprint)
+{
+    uint64_t h1 = fingerprint, h2 = _as_mix(fingerprint) | 1;
+    for (int i = 0; i < _as_kBloomProbes; i++) {
+        uint64_t bit = (h1 + i * h2) & (_as_kBloomBits - 1);
+        if (!(__atomic_load_n(&bloom->words[bit / 64], __ATOMIC_RELAXED) & (1ull << (bit % 64)))) return NO;
+    }
+    return YES;
+}
+
+static inline void _as_bloomAdd(_as_bloom_t *bloom, uint64_t fingerprint)
+{
+    uint64_t h1 = fingerprint, h2 = _as_mix(fingerprint) | 1;
+    for (int i = 0; i < _as_kBloomProbes; i++) {
+        uint64_t bit = (h1 + i * h2) & (_as_kBloomBits - 1);
+        __atomic_fetch_or(&bloom->words[bit / 64], 1ull << (bit % 64), __ATOMIC_RELAXED);
+    }
+}
+
+// Passes back YES if fingerprint wasn't in this period's or the previous period's filter, and adds it.
+// Like the cardinality windows, the first report of a period clears the filter left from two periods ago.
+static inline BOOL _as_firstSeen(uint64_t fingerprint, uint64_t now)
+{
+    uint64_t epoch = now / ((uint64_t)kEzErrFirstSeenPeriod * 1000000000ull) + 1;
+    _as_bloom_t *current = &_as_blooms[epoch & 1];
+    _as_bloom_t *previous = &_as_blooms[(epoch + 1) & 1];
+
+    uint64_t seen = __atomic_load_n(&current->epoch, __ATOMIC_ACQUIRE);
+    if (seen != epoch && __atomic_compare_exchange_n(&current->epoch, &seen, epoch, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (seen == 0) _as_memoryCharge(kEzErrMemorySketches, sizeof(_as_bloom_t));
+        for (int i = 0; i < _as_kBloomBits / 64; i++) __atomic_store_n(&current->words[i], 0, __ATOMIC_RELAXED);
+    }
+
+    if (_as_bloomContains(current, fingerprint)) return NO;
+    BOOL inPrevious = __atomic_load_n(&previous->epoch, __ATOMIC_ACQUIRE) == epoch - 1 && _as_bloomContains(previous, fingerprint);
+    _as_bloomAdd(current, fingerprint);
+    return !inPrevious;
+}
+
+
+// Open addressing; a new domain claims an empty slot with a CAS and copies its name once.
+static inline _as_domainSlot *_as_domainSlotFor(const char *domain, uint64_t hash)
+{
+    for (uint64_t i = 0; i < _as_kDomainSlots; i++) {
+        _as_domainSlot *slot = &_as_stats.domains[(hash + i) & (_as_kDomainSlots - 1)];
+        uint64_t seen = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (seen == 0) {
+            if (__atomic_compare_exchange_n(&slot->hash, &seen, hash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                size_t size = strlen(domain) + 1; // not strdup, which strict ISO C doesn't declare
+                char *name = (char *)malloc(size);
+                memcpy(name, domain, size);
+                __atomic_store_n(&slot->name, name, __ATOMIC_RELEASE);
+                _as_memoryCharge(kEzErrMemoryDomains, strlen(domain) + 1);
+                return slot;
+            }
+        }
+        if (seen == hash) return slot;
+    }
+    return NULL;
+}
+
+// Passes back the domain's slot index, or -1 if the table is full
+static inline int _as_recordStats(const char *domain, uint64_t hash, uint64_t fingerprint, uint64_t detailHash, int onMainThread, uint64_t now)
+{
+    _as_statsStripe *stripe = _as_statsBegin();
+
+    __atomic_fetch_add(&_as_stats.count, 1, __ATOMIC_RELAXED);
+    if (onMainThread) __atomic_fetch_add(&_as_stats.mainThreadCount, 1, __ATOMIC_RELAXED);
+    uint64_t unset = 0;
+    __atomic_compare_exchange_n(&_as_stats.firstNanos, &unset, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_store_n(&_as_stats.lastNanos, now, __ATOMIC_RELAXED);
+
+    _as_domainSlot *slot = _as_domainSlotFor(domain, hash);
+    __atomic_fetch_add(slot ? &slot->count : &_as_stats.otherDomainCount, 1, __ATOMIC_RELAXED);
+
+    // Inside the seqlock too, so a snapshot's domain sketches agree with its counts and never catch a window half cleared
+    _as_window_t *window = _as_window(now);
+    if (slot) _as_hllAdd(&window->domains[slot - _as_stats.domains], fingerprint);
+    _as_hllAdd(&window->kinds, fingerprint);
+    _as_hllAdd(&window->details, detailHash);
+
+    _as_statsEnd(stripe);
+    return slot ? (int)(slot - _as_stats.domains) : -1;
+}
+
+
+// MARK: - Internal anomaly detection
+
+#define _as_kSiteDetectors   256
+#define _as_kAnomalyAlpha    0.1  // weight of the newest second
+#define _as_kAnomalyWarmup   10   // seconds of history before alarming
+#define _as_kAnomalyMinCount 5    // never alarm below this many errors in a second
+
+typedef struct {
+    uint64_t key;       // site hash for site detectors, unused for domains
+    uint64_t second;    // the second being counted
+    uint64_t count;     // errors in that second
+    uint64_t samples;   // seconds folded into the mean
+    uint64_t alarmed;
+    double   mean;
+    double   variance;
+} _as_rateDetector;
+
+_as_shared _as_rateDetector _as_domainRates[_as_kDomainSlots]; // parallel to _as_stats.domains
+_as_shared _as_rateDetector _as_siteRates[_as_kSiteDetectors];  // direct-mapped, a colliding site takes the slot over
+
+static inline void _as_ewmaAdd(double *mean, double *variance, double x)
+{
+    double diff = x - *mean;
+    double increment = _as_kAnomalyAlpha * diff;
+    *mean += increment;
+    *variance = (1 - _as_kAnomalyAlpha) * (*variance + diff * increment);
+}
+
+static inline double _as_anomalyThreshold(double mean, double variance)
+{
+    double threshold = mean + kEzErrAnomalySigma * sqrt(variance);
+    return threshold > _as_kAnomalyMinCount ? threshold : _as_kAnomalyMinCount;
+}
+
+// Counts one error. Passes back YES if it makes the current second anomalous and the detector wasn't already alarmed.
+// Whoever moves the detector to a new second folds the finished second, and any silent seconds, into the averages.
+static inline BOOL _as_rateAnomaly(_as_rateDetector *detector, uint64_t now, double *rate, double *mean, double *sigma)
+{
+    uint64_t second = now / 1000000000ull;
+    uint64_t bucket = __atomic_load_n(&detector->second, __ATOMIC_ACQUIRE);
+    if (bucket != second && __atomic_compare_exchange_n(&detector->second, &bucket, second, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        uint64_t finished = __atomic_exchange_n(&detector->count, 0, __ATOMIC_ACQ_REL);
+        double m, v;
+        __atomic_load(&detector->mean, &m, __ATOMIC_RELAXED);
+        __atomic_load(&detector->variance, &v, __ATOMIC_RELAXED);
+        if (bucket && finished <= _as_anomalyThreshold(m, v)) __atomic_store_n(&detector->alarmed, 0, __ATOMIC_RELAXED);
+        if (bucket) {
+            _as_ewmaAdd(&m, &v, finished);
+            // A minute of silence decays the averages as far as they meaningfully go
+            uint64_t silent = second - bucket - 1;
+            for (uint64_t i = 0; i < silent && i < 60; i++) _as_ewmaAdd(&m, &v, 0);
+            __atomic_fetch_add(&detector->samples, 1 + silent, __ATOMIC_RELAXED);
+        }
+        __atomic_store(&detector->mean, &m, __ATOMIC_RELAXED);
+        __atomic_store(&detector->variance, &v, __ATOMIC_RELAXED);
+    }
+
+    uint64_t count = __atomic_add_fetch(&detector->count, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&detector->samples, __ATOMIC_RELAXED) < _as_kAnomalyWarmup) return NO;
+
+    __atomic_load(&detector->mean, mean, __ATOMIC_RELAXED);
+    double variance;
+    __atomic_load(&detector->variance, &variance, __ATOMIC_RELAXED);
+    if (count <= _as_anomalyThreshold(*mean, variance)) return NO;
+    if (__atomic_exchange_n(&detector->alarmed, 1, __ATOMIC_ACQ_REL)) return NO;
+
+    *rate = count;
+    *sigma = sqrt(variance);
+    return YES;
+}
+
+static inline _as_rateDetector *_as_siteDetector(uint64_t siteHash)
+{
+    _as_rateDetector *detector = &_as_siteRates[siteHash & (_as_kSiteDetectors - 1)];
+    uint64_t key = __atomic_load_n(&detector->key, __ATOMIC_ACQUIRE);
+    if (key != siteHash && __atomic_compare_exchange_n(&detector->key, &key, siteHash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Start the new site from scratch
+        __atomic_store_n(&detector->second, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&detector->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&detector->samples, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&detector->alarmed, 0, __ATOMIC_RELAXED);
+        double zero = 0;
+        __atomic_store(&detector->mean, &zero, __ATOMIC_RELAXED);
+        __atomic_store(&detector->variance, &zero, __ATOMIC_RELAXED);
+    }
+    return detector;
+}
+
+
+// MARK: - Internal error budgets
+
+#define _as_kSLOShards  16
+#define _as_kSLOSamples (6 * 60 + 1) // a sample per minute across the longest window
+
+// One cache line per shard so threads counting successes don't contend
+typedef struct {
+    uint64_t value;
+    char     padding[56];
+} _as_paddedCounter;
+
+struct _as_slo {
+    double   maxErrorRatio;
+    _as_paddedCounter successes[_as_kSLOShards];
+    uint64_t errors;
+    uint64_t minute; // latest sampled minute + 1
+    struct {
+        uint64_t minute;
+        uint64_t successes;
+        uint64_t errors;
+    } samples[_as_kSLOSamples];
+};
+
+_as_shared struct _as_slo _as_slos[kEzErrMaxSLOs];
+_as_shared uint64_t _as_sloCount;
+_as_shared struct _as_slo *_as_domainSLOs[_as_kDomainSlots]; // parallel to _as_stats.domains
+
+static inline unsigned _as_shardIndex(void)
+{
+    static __thread unsigned shard;
+    if (!shard) shard = (unsigned)(_as_mix((uint64_t)(uintptr_t)&shard) % _as_kSLOShards) + 1;
+    return shard - 1;
+}
+
+static inline uint64_t _as_sloSuccesses(struct _as_slo *slo)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < _as_kSLOShards; i++) total += __atomic_load_n(&slo->successes[i].value, __ATOMIC_RELAXED);
+    return total;
+}
+
+// Records the running totals once per minute, from the error path or a status check, never from ezErrSLOSuccess
+static inline void _as_sloSample(struct _as_slo *slo, uint64_t now)
+{
+    uint64_t minute = now / 60000000000ull + 1;
+    uint64_t seen = __atomic_load_n(&slo->minute, __ATOMIC_ACQUIRE);
+    if (seen == minute || !__atomic_compare_exchange_n(&slo->minute, &seen, minute, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+
+    __typeof__(slo->samples[0]) *sample = &slo->samples[minute % _as_kSLOSamples];
+    __atomic_store_n(&sample->minute, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->successes, _as_sloSuccesses(slo), __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->errors, __atomic_load_n(&slo->errors, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->minute, minute, __ATOMIC_RELEASE);
+}
+
+static inline void _as_sloError(int domainSlot, uint64_t now)
+{
+    if (domainSlot < 0) return;
+    struct _as_slo *slo = __atomic_load_n(&_as_domainSLOs[domainSlot], __ATOMIC_ACQUIRE);
+    if (!slo) return;
+    __atomic_fetch_add(&slo->errors, 1, __ATOMIC_RELAXED);
+    _as_sloSample(slo, now);
+}
+
+static inline void ezErrSLOSuccess(ezErrSLO *slo)
+{
+    if (slo) __atomic_fetch_add(&slo->successes[_as_shardIndex()].value, 1, __ATOMIC_RELAXED);
+}
+
+#ifdef __OBJC__
+static inline ezErrSLO *ezErrRegisterSLO(NSString *domain, double maxErrorRatio)
+{
+    const char *name = domain.UTF8String;
+    if (!name || maxErrorRatio <= 0) return NULL;
+    _as_domainSlot *slot = _as_domainSlotFor(name, _as_hash(name, strlen(name)));
+    if (!slot) return NULL;
+    int index = (int)(slot - _as_stats.domains);
+
+    struct _as_slo *existing = __atomic_load_n(&_as_domainSLOs[index], __ATOMIC_ACQUIRE);
+    if (existing) return existing;
+
+    uint64_t count = __atomic_fetch_add(&_as_sloCount, 1, __ATOMIC_ACQ_REL);
+    if (count >= kEzErrMaxSLOs) return NULL;
+    struct _as_slo *slo = &_as_slos[count];
+    slo->maxErrorRatio = maxErrorRatio;
+    _as_sloSample(slo, _as_now());
+
+    // Two threads registering the same domain at once: the first to publish wins, the other slot goes unused
+    if (!__atomic_compare_exchange_n(&_as_domainSLOs[index], &existing, slo, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return existing;
+    _as_memoryCharge(kEzErrMemorySLOs, sizeof(struct _as_slo));
+    return slo;
+}
+#endif
+
+static inline void ezErrSLOStatusGet(ezErrSLO *slo, ezErrSLOStatus *status)
+{
+    static const uint64_t windowMinutes[kEzErrSLOWindowCount] = {5, 60, 360};
+
+    memset(status, 0, sizeof(*status));
+    if (!slo) return;
+
+    uint64_t now = _as_now();
+    _as_sloSample(slo, now);
+    uint64_t minute = now / 60000000000ull + 1;
+    status->successes = _as_sloSuccesses(slo);
+    status->errors = __atomic_load_n(&slo->errors, __ATOMIC_RELAXED);
+
+    for (int w = 0; w < kEzErrSLOWindowCount; w++) {
+        // Baseline: the oldest sample still inside the window
+        uint64_t from = minute > windowMinutes[w] ? minute - windowMinutes[w] : 1;
+        uint64_t baseMinute = UINT64_MAX, baseSuccesses = 0, baseErrors = 0;
+        for (int i = 0; i < _as_kSLOSamples; i++) {
+            uint64_t sampleMinute = __atomic_load_n(&slo->samples[i].minute, __ATOMIC_ACQUIRE);
+            if (sampleMinute < from || sampleMinute >= baseMinute) continue;
+            baseMinute    = sampleMinute;
+            baseSuccesses = __atomic_load_n(&slo->samples[i].successes, __ATOMIC_RELAXED);
+            baseErrors    = __atomic_load_n(&slo->samples[i].errors, __ATOMIC_RELAXED);
+        }
+
+        uint64_t errors = status->errors - baseErrors;
+        uint64_t operations = errors + status->successes - baseSuccesses;
+        status->errorRatio[w] = operations ? (double)errors / operations : 0;
+        status->burnRate[w] = status->errorRatio[w] / slo->maxErrorRatio;
+    }
+}
+
+
+// MARK: - Internal C reports
+
+// Multi-producer ring, drained by one dispatch source. A slot's turn is 2 * round while free and 2 * round + 1 once filled,
+// so the zeroed ring starts out free and reporters never allocate or wait.
+
+#define _as_kCRingSlots 256
+#define _as_kCDomainMax 64
+
+typedef struct {
+    uint64_t turn;
+    const ezerr_site *site;
+    int64_t  code;
+    int      onMainThread;
+    char     domain[_as_kCDomainMax];
+    char     detail[kEzErrCDetailMax];
+} _as_cReport;
+
+typedef struct {
+    uint64_t head;       // next position to claim
+    char     padding[56];
+    uint64_t tail;       // next position to drain, drain handler only
+    _as_cReport slots[_as_kCRingSlots];
+} _as_cRing_t;
+
+_as_shared _as_cRing_t _as_cRing;
+_as_shared void *_as_cWake; // retained DATA_OR dispatch source
+_as_shared uint64_t _as_cWakeCreating;
+
+// Defined by every Objective-C file that imports ezErr.h. Null in a process without one.
+#ifdef __cplusplus
+extern "C"
+#endif
+_as_shared void _as_drainCReports(void *context);
+
+#if defined(__OBJC__)
+#define _as_bridgeRetained(object) ((__bridge_retained void *)(object))
+#define _as_bridge(type, pointer)  ((__bridge type)(pointer))
+#else
+#define _as_bridgeRetained(object) ((void *)(object))
+#define _as_bridge(type, pointer)  ((type)(pointer))
+#endif
+
+// Dispatch objects are Objective-C objects only where libdispatch makes them so. Linux libdispatch has plain C ones.
+#if defined(__OBJC__) && OS_OBJECT_USE_OBJC
+#define _as_bridgeDispatchRetained(object) _as_bridgeRetained(object)
+#define _as_bridgeDispatch(type, pointer)  _as_bridge(type, pointer)
+#else
+#define _as_bridgeDispatchRetained(object) ((void *)(object))
+#define _as_bridgeDispatch(type, pointer)  ((type)(pointer))
+#endif
+
+#define _as_site()\
+({ static const ezerr_site _as_siteInfo = {__FILE__, __func__, __LINE__}; &_as_siteInfo; })
+
+static inline int _as_onMainThread(void)
+{
+#if defined(__APPLE__)
+    return pthread_main_np();
+#elif defined(__linux__) && (defined(_GNU_SOURCE) || defined(_DEFAULT_SOURCE) || defined(_BSD_SOURCE) || defined(__USE_MISC))
+    return getpid() == (pid_t)syscall(SYS_gettid); // syscall() is hidden in strict ISO modes, which report no main thread
+#else
+    return 0;
+#endif
+}
+
+static inline void _as_wakeDrain(void)
+{
+#ifdef _as_hasDispatch
+    void *wake = __atomic_load_n(&_as_cWake, __ATOMIC_ACQUIRE);
+    if (wake) {
+        dispatch_source_merge_data(_as_bridgeDispatch(dispatch_source_t, wake), 1);
+        return;
+    }
+
+    // First report: one reporter creates the source. Reports that race it are picked up by its first drain.
+    uint64_t expected = 0;
+    if (!_as_drainCReports || !__atomic_compare_exchange_n(&_as_cWakeCreating, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+    dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, dispatch_get_global_queue(_as_kUtilityQoS, 0));
+    dispatch_source_set_event_handler_f(source, _as_drainCReports);
+    dispatch_resume(source);
+    _as_memoryCharge(kEzErrMemoryQueued, sizeof(_as_cRing_t));
+    __atomic_store_n(&_as_cWake, _as_bridgeDispatchRetained(source), __ATOMIC_RELEASE);
+    dispatch_source_merge_data(source, 1);
+#endif
+}
+
+// Moves a cut at length back to the start of the UTF-8 sequence it would split, so the kept bytes still decode
+static inline size_t _as_utf8Cut(const char *bytes, size_t length)
+{
+    size_t start = length;
+    while (start > 0 && length - start < 3 && ((unsigned char)bytes[start - 1] & 0xC0) == 0x80) start--;
+    if (start == 0) return length; // Continuation bytes only: not UTF-8, leave it to the drain
+    unsigned char lead = (unsigned char)bytes[start - 1];
+    size_t needed = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return length - (start - 1) >= needed ? length : start - 1;
+}
+
+static inline void _as_cFill(_as_cReport *report, uint64_t position, const ezerr_site *site, int64_t code, const char *domain, const char *detail, size_t len, int onMainThread)
+{
+    report->site = site;
+    report->code = code;
+    report->onMainThread = onMainThread;
+    if (!domain) domain = "NoDomain";
+    const char *domainEnd = (const char *)memchr(domain, 0, _as_kCDomainMax - 1);
+    size_t domainLength = domainEnd ? (size_t)(domainEnd - domain) : _as_utf8Cut(domain, _as_kCDomainMax - 1);
+    memcpy(report->domain, domain, domainLength);
+    report->domain[domainLength] = 0;
+    if (!detail) len = 0;
+    if (len > kEzErrCDetailMax - 1) len = _as_utf8Cut(detail, kEzErrCDetailMax - 1);
+    if (len) memcpy(report->detail, detail, len);
+    report->detail[len] = 0;
+    __atomic_store_n(&report->turn, 2 * (position / _as_kCRingSlots) + 1, __ATOMIC_RELEASE);
+}
+
+// Claims up to count consecutive free slots with one compare-and-swap. Passes back how many, and the first position.
+// Slots are freed in order, so if the last one wanted is free, so are the ones before it.
+static inline size_t _as_cClaim(size_t count, uint64_t *first)
+{
+    uint64_t position = __atomic_load_n(&_as_cRing.head, __ATOMIC_RELAXED);
+    if (count > _as_kCRingSlots) count = _as_kCRingSlots;
+    for (;;) {
+        size_t claim = count;
+        while (claim > 0) {
+            uint64_t last = position + claim - 1;
+            uint64_t turn = __atomic_load_n(&_as_cRing.slots[last % _as_kCRingSlots].turn, __ATOMIC_ACQUIRE);
+            if (turn >= 2 * (last / _as_kCRingSlots)) break;
+            claim /= 2; // not drained yet: the ring is too full for all of them
+        }
+        if (claim == 0) return 0;
+
+        uint64_t turn = __atomic_load_n(&_as_cRing.slots[position % _as_kCRingSlots].turn, __ATOMIC_ACQUIRE);
+        if (turn == 2 * (position / _as_kCRingSlots) &&
+            __atomic_compare_exchange_n(&_as_cRing.head, &position, position + claim, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *first = position;
+            return claim;
+        }
+        if (turn != 2 * (position / _as_kCRingSlots)) position = __atomic_load_n(&_as_cRing.head, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void ezerr_report(const ezerr_site *site, int64_t code, const char *domain, const char *detail, size_t len)
+{
+    uint64_t position;
+    if (!_as_cClaim(1, &position)) {
+        __atomic_fetch_add(&_as_stats.droppedLogs, 1, __ATOMIC_RELAXED); // full
+        return;
+    }
+    _as_cFill(&_as_cRing.slots[position % _as_kCRingSlots], position, site, code, domain, detail, len, _as_onMainThread());
+    _as_wakeDrain();
+}
+
+static inline size_t _as_ezerrBatch(const ezerr_site *site, const int64_t *codes, size_t count, const char *domain, const char *detail)
+{
+    size_t failures = 0;
+    for (size_t i = 0; i < count; i++) failures += codes[i] != 0;
+
+    size_t len = detail ? strlen(detail) : 0;
+    int onMainThread = _as_onMainThread();
+    size_t next = 0;
+    for (size_t left = failures; left > 0;) {
+        uint64_t position;
+        size_t claimed = _as_cClaim(left, &position);
+        if (!claimed) {
+            __atomic_fetch_add(&_as_stats.droppedLogs, left, __ATOMIC_RELAXED); // full
+            break;
+        }
+        for (size_t i = 0; i < claimed; i++, position++) {
+            while (codes[next] == 0) next++;
+            _as_cFill(&_as_cRing.slots[position % _as_kCRingSlots], position, site, codes[next++], domain, detail, len, onMainThread);
+        }
+        left -= claimed;
+    }
+    if (failures) _as_wakeDrain();
+    return failures;
+}
+
+#ifdef __cplusplus
+// Any container of integers, copied a ring's worth at a time
+template <typename Codes>
+static inline size_t _as_ezerrBatch(const ezerr_site *site, const Codes &codes, const char *domain, const char *detail)
+{
+    int64_t chunk[_as_kCRingSlots];
+    size_t count = 0, failures = 0;
+    for (const auto &code : codes) {
+        if (!code) continue;
+        chunk[count++] = (int64_t)code;
+        if (count == _as_kCRingSlots) {
+            failures += _as_ezerrBatch(site, chunk, count, domain, detail);
+            count = 0;
+        }
+    }
+    return failures + (count ? _as_ezerrBatch(site, chunk, count, domain, detail) : 0);
+}
+#endif
+
+static inline BOOL _as_ezerr(const ezerr_site *site, int64_t code, const char *domain, const char *detail)
+{
+    if (!code) return NO;
+    ezerr_report(site, code, domain, detail, detail ? strlen(detail) : 0);
+    return YES;
+}
+
+// MARK: - Internal CBOR
+
+// Just enough CBOR (RFC 8949) to write into and read from a caller's buffer. Writes fail rather than grow;
+// callers roll back by restoring length.
+typedef struct {
+    uint8_t *bytes;
+    size_t   length;
+    size_t   capacity;
+} _as_cbor_t;
+
+static inline BOOL _as_cborPut(_as_cbor_t *cbor, uint8_t initial, uint64_t value, size_t size)
+{
+    if (cbor->capacity - cbor->length < 1 + size) return NO;
+    uint8_t *out = cbor->bytes + cbor->length;
+    *out++ = initial;
+    for (size_t i = size; i > 0; i--) *out++ = (uint8_t)(value >> (8 * (i - 1)));
+    cbor->length += 1 + size;
+    return YES;
+}
+
+// Major type and argument, in the shortest form
+static inline BOOL _as_cborHead(_as_cbor_t *cbor, uint8_t major, uint64_t value)
+{
+    major <<= 5;
+    if (value < 24)          return _as_cborPut(cbor, major | (uint8_t)value, 0, 0);
+    if (value <= UINT8_MAX)  return _as_cborPut(cbor, major | 24, value, 1);
+    if (value <= UINT16_MAX) return _as_cborPut(cbor, major | 25, value, 2);
+    if (value <= UINT32_MAX) return _as_cborPut(cbor, major | 26, value, 4);
+    return _as_cborPut(cbor, major | 27, value, 8);
+}
+
+static inline BOOL _as_cborInt(_as_cbor_t *cbor, int64_t value)
+{
+    return value < 0 ? _as_cborHead(cbor, 1, (uint64_t)(-1 - value)) : _as_cborHead(cbor, 0, (uint64_t)value);
+}
+
+static inline BOOL _as_cborDouble(_as_cbor_t *cbor, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    return _as_cborPut(cbor, 7 << 5 | 27, bits, 8);
+}
+
+// Byte strings are major type 2, text strings 3. Text is cut at max bytes, on a UTF-8 character boundary.
+static inline BOOL _as_cborString(_as_cbor_t *cbor, uint8_t major, const void *bytes, size_t length, size_t max)
+{
+    if (length > max) {
+        length = max;
+        while (major == 3 && length > 0 && (((const uint8_t *)bytes)[length] & 0xC0) == 0x80) length--;
+    }
+    size_t mark = cbor->length;
+    if (!_as_cborHead(cbor, major, length) || cbor->capacity - cbor->length < length) {
+        cbor->length = mark;
+        return NO;
+    }
+    memcpy(cbor->bytes + cbor->length, bytes, length);
+    cbor->length += length;
+    return YES;
+}
+
+static inline BOOL _as_cborText(_as_cbor_t *cbor, const char *text)
+{
+    return _as_cborString(cbor, 3, text, strlen(text), SIZE_MAX);
+}
+
+#define _as_kCborFalse     20
+#define _as_kCborTrue      21
+#define _as_kCborNull      22
+#define _as_kCborUndefined 23
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t         length;
+    size_t         position;
+} _as_cborReader_t;
+
+typedef struct {
+    uint8_t        major;
+    uint8_t        info;   // additional information: 27 marks a double for major type 7
+    uint64_t       value;  // integer, string length, entry count, tag or simple value
+    double         number;
+    const uint8_t *bytes;  // string contents
+} _as_cborItem;
+
+// Reads the next item's head, and for strings steps over the contents. Indefinite lengths aren't used, so they are malformed.
+static inline BOOL _as_cborNext(_as_cborReader_t *reader, _as_cborItem *item)
+{
+    if (reader->position >= reader->length) return NO;
+    uint8_t initial = reader->bytes[reader->position++];
+    item->major = initial >> 5;
+    item->info = initial & 31;
+    item->bytes = NULL;
+
+    size_t size = item->info < 24 ? 0 : item->info == 24 ? 1 : item->info == 25 ? 2 : item->info == 26 ? 4 : item->info == 27 ? 8 : 9;
+    if (size > 8 || reader->length - reader->position < size) return NO;
+    item->value = size ? 0 : item->info;
+    for (size_t i = 0; i < size; i++) item->value = item->value << 8 | reader->bytes[reader->position++];
+
+    if (item->major == 7 && item->info == 26) {
+        float single;
+        uint32_t bits = (uint32_t)item->value;
+        memcpy(&single, &bits, sizeof single);
+        item->number = single;
+    } else if (item->major == 7 && item->info == 27) {
+        memcpy(&item->number, &item->value, sizeof item->number);
+    } else if (item->major == 7 && item->info == 25) {
+        return NO;
+    }
+
+    if (item->major == 2 || item->major == 3) {
+        if (reader->length - reader->position < item->value) return NO;
+        item->bytes = reader->bytes + reader->position;
+        reader->position += (size_t)item->value;
+    }
+    return YES;
+}
+
+
+// MARK: - Internal events
+
+#define _as_kEventFields 12 // every key but the optional userInfo
+
+static inline BOOL _as_cborRaw(_as_cbor_t *cbor, const void *bytes, size_t length)
+{
+    if (cbor->capacity - cbor->length < length) return NO;
+    if (length) memcpy(cbor->bytes + cbor->length, bytes, length);
+    cbor->length += length;
+    return YES;
+}
+
+static inline BOOL _as_eventText(_as_cbor_t *cbor, ezErrEventKey key, ezErrString text)
+{
+    return _as_cborInt(cbor, key) && _as_cborString(cbor, 3, text.bytes ? text.bytes : "", text.bytes ? text.length : 0, SIZE_MAX);
+}
+
+static inline BOOL _as_eventInt(_as_cbor_t *cbor, ezErrEventKey key, int64_t value)
+{
+    return _as_cborInt(cbor, key) && _as_cborInt(cbor, value);
+}
+
+static inline BOOL _as_eventBool(_as_cbor_t *cbor, ezErrEventKey key, BOOL value)
+{
+    return _as_cborInt(cbor, key) && _as_cborHead(cbor, 7, value ? _as_kCborTrue : _as_kCborFalse);
+}
+
+static inline size_t ezErrEventEncode(const ezErrEvent *event, uint8_t *buffer, size_t capacity)
+{
+    _as_cbor_t cbor = {buffer, 0, capacity};
+    size_t underlyingCount = event->underlyingCount < kEzErrEventMaxUnderlying ? event->underlyingCount : kEzErrEventMaxUnderlying;
+    BOOL fits = _as_cborHead(&cbor, 6, kEzErrEventTag)
+             && _as_cborHead(&cbor, 5, _as_kEventFields + (event->userInfo ? 1 : 0))
+             && _as_eventInt(&cbor, kEzErrEventVersion, 1)
+             && _as_eventText(&cbor, kEzErrEventDetail, event->detail)
+             && _as_eventText(&cbor, kEzErrEventFile, event->file)
+             && _as_eventText(&cbor, kEzErrEventFunction, event->function)
+             && _as_eventInt(&cbor, kEzErrEventLine, event->line)
+             && _as_eventBool(&cbor, kEzErrEventMainThread, event->onMainThread)
+             && _as_cborInt(&cbor, kEzErrEventDate) && _as_cborDouble(&cbor, event->date)
+             && _as_eventText(&cbor, kEzErrEventDomain, event->domain)
+             && _as_eventInt(&cbor, kEzErrEventCode, event->code)
+             && _as_eventInt(&cbor, kEzErrEventClass, event->errorClass)
+             && _as_eventBool(&cbor, kEzErrEventFirstSeen, event->firstSeen)
+             && _as_cborInt(&cbor, kEzErrEventUnderlying) && _as_cborHead(&cbor, 4, underlyingCount);
+    for (size_t i = 0; fits && i < underlyingCount; i++) {
+        const ezErrUnderlying *underlying = &event->underlying[i];
+        fits = _as_cborHead(&cbor, 4, 2)
+            && _as_cborString(&cbor, 3, underlying->domain.bytes ? underlying->domain.bytes : "", underlying->domain.bytes ? underlying->domain.length : 0, SIZE_MAX)
+            && _as_cborInt(&cbor, underlying->code);
+    }
+    if (fits && event->userInfo) {
+        fits = _as_cborInt(&cbor, kEzErrEventUserInfo) && _as_cborRaw(&cbor, event->userInfo, event->userInfoLength);
+    }
+    return fits ? cbor.length : 0;
+}
+
+// Steps over whatever the item just read contains
+static inline BOOL _as_cborSkip(_as_cborReader_t *reader, const _as_cborItem *item, int depth)
+{
+    if (depth > 32) return NO;
+    uint64_t children = item->major == 4 ? item->value : item->major == 5 ? 2 * item->value : item->major == 6 ? 1 : 0;
+    for (uint64_t i = 0; i < children; i++) {
+        _as_cborItem child;
+        if (!_as_cborNext(reader, &child) || !_as_cborSkip(reader, &child, depth + 1)) return NO;
+    }
+    return YES;
+}
+
+static inline BOOL _as_cborToInt(const _as_cborItem *item, int64_t *value)
+{
+    if (item->major == 0 && item->value <= INT64_MAX) *value = (int64_t)item->value;
+    else if (item->major == 1 && item->value <= INT64_MAX) *value = -1 - (int64_t)item->value;
+    else return NO;
+    return YES;
+}
+
+static inline BOOL _as_cborToText(const _as_cborItem *item, ezErrString *text)
+{
+    if (item->major != 3) return NO;
+    text->bytes = (const char *)item->bytes;
+    text->length = (size_t)item->value;
+    return YES;
+}
+
+static inline BOOL _as_cborToBool(const _as_cborItem *item, BOOL *value)
+{
+    if (item->major != 7 || (item->value != _as_kCborFalse && item->value != _as_kCborTrue)) return NO;
+    *value = item->value == _as_kCborTrue;
+    return YES;
+}
+
+static inline BOOL _as_decodeUnderlying(_as_cborReader_t *reader, const _as_cborItem *array, ezErrEvent *event)
+{
+    if (array->major != 4) return NO;
+    for (uint64_t i = 0; i < array->value; i++) {
+        _as_cborItem pair, domain, code;
+        if (!_as_cborNext(reader, &pair)) return NO;
+        if (pair.major != 4 || pair.value < 2 || event->underlyingCount == kEzErrEventMaxUnderlying) {
+            if (!_as_cborSkip(reader, &pair, 0)) return NO;
+            continue;
+        }
+        ezErrUnderlying *underlying = &event->underlying[event->underlyingCount++];
+        if (!_as_cborNext(reader, &domain) || !_as_cborToText(&domain, &underlying->domain)) return NO;
+        if (!_as_cborNext(reader, &code) || !_as_cborToInt(&code, &underlying->code)) return NO;
+        for (uint64_t extra = 2; extra < pair.value; extra++) {
+            _as_cborItem skipped;
+            if (!_as_cborNext(reader, &skipped) || !_as_cborSkip(reader, &skipped, 0)) return NO;
+        }
+    }
+    return YES;
+}
+
+static inline size_t ezErrEventDecode(const uint8_t *bytes, size_t length, ezErrEvent *event)
+{
+    _as_cborReader_t reader = {bytes, length, 0};
+    _as_cborItem item;
+    memset(event, 0, sizeof *event);
+    if (!_as_cborNext(&reader, &item) || item.major != 6 || item.value != kEzErrEventTag) return 0;
+    if (!_as_cborNext(&reader, &item) || item.major != 5) return 0;
+
+    for (uint64_t i = 0; i < item.value; i++) {
+        _as_cborItem key, value;
+        int64_t number = 0;
+        if (!_as_cborNext(&reader, &key) || key.major != 0) return 0;
+        size_t start = reader.position;
+        if (!_as_cborNext(&reader, &value)) return 0;
+
+        BOOL ok;
+        switch (key.value) {
+            case kEzErrEventDetail:     ok = _as_cborToText(&value, &event->detail); break;
+            case kEzErrEventFile:       ok = _as_cborToText(&value, &event->file); break;
+            case kEzErrEventFunction:   ok = _as_cborToText(&value, &event->function); break;
+            case kEzErrEventDomain:     ok = _as_cborToText(&value, &event->domain); break;
+            case kEzErrEventLine:       ok = _as_cborToInt(&value, &event->line); break;
+            case kEzErrEventCode:       ok = _as_cborToInt(&value, &event->code); break;
+            case kEzErrEventMainThread: ok = _as_cborToBool(&value, &event->onMainThread); break;
+            case kEzErrEventFirstSeen:  ok = _as_cborToBool(&value, &event->firstSeen); break;
+            case kEzErrEventClass:
+                ok = _as_cborToInt(&value, &number);
+                event->errorClass = (ezErrClass)number;
+                break;
+            case kEzErrEventDate:
+                ok = (value.major == 7 && value.info >= 26) || _as_cborToInt(&value, &number);
+                event->date = value.major == 7 ? value.number : (double)number;
+                break;
+            case kEzErrEventUnderlying: ok = _as_decodeUnderlying(&reader, &value, event); break;
+            case kEzErrEventUserInfo:
+                ok = value.major == 5 && _as_cborSkip(&reader, &value, 0);
+                event->userInfo = bytes + start;
+                event->userInfoLength = reader.position - start;
+                break;
+            default: ok = _as_cborSkip(&reader, &value, 0); break;
+        }
+        if (!ok) return 0;
+    }
+    return reader.position;
+}
+
+
+// MARK: - Internal event streams
+
+// Fields a delta record can carry. File and line make the site, so they never change.
+#define _as_kDeltaFields ((1u << kEzErrEventDetail) | (1u << kEzErrEventFunction) | (1u << kEzErrEventMainThread) | \
+                          (1u << kEzErrEventDate) | (1u << kEzErrEventDomain) | (1u << kEzErrEventCode) | \
+                          (1u << kEzErrEventClass) | (1u << kEzErrEventFirstSeen) | (1u << kEzErrEventUnderlying) | \
+                          (1u << kEzErrEventUserInfo))
+
+#define _as_kMaxDateDelta 1e12 // seconds; past this a delta wouldn't fit in microseconds
+
+// LEB128
+static inline BOOL _as_varintPut(_as_cbor_t *out, uint64_t value)
+{
+    do {
+        if (out->length == out->capacity) return NO;
+        out->bytes[out->length++] = (uint8_t)(value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+    return YES;
+}
+
+static inline BOOL _as_varintGet(_as_cborReader_t *in, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (in->position >= in->length) return NO;
+        uint8_t byte = in->bytes[in->position++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return YES;
+    }
+    return NO;
+}
+
+static inline uint64_t _as_zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t _as_unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline BOOL _as_varintText(_as_cbor_t *out, ezErrString text)
+{
+    return _as_varintPut(out, text.bytes ? text.length : 0) && _as_cborRaw(out, text.bytes, text.bytes ? text.length : 0);
+}
+
+static inline BOOL _as_varintBytes(_as_cborReader_t *in, const uint8_t **bytes, size_t *length)
+{
+    uint64_t count;
+    if (!_as_varintGet(in, &count) || in->length - in->position < count) return NO;
+    *bytes = in->bytes + in->position;
+    *length = (size_t)count;
+    in->position += (size_t)count;
+    return YES;
+}
+
+static inline uint64_t _as_textHash(ezErrString text)
+{
+    return text.bytes ? _as_hash(text.bytes, text.length) : _as_hash("", 0);
+}
+
+static inline size_t _as_eventSlot(ezErrString file, int64_t line, uint64_t *site)
+{
+    *site = _as_mix(_as_textHash(file) ^ (uint64_t)line);
+    if (!*site) *site = 1;
+    return (size_t)(*site % kEzErrEventStreamSites);
+}
+
+// The encoder's view of the fields it can't keep: 0 for no userInfo, which can't collide since _as_hash never returns 0
+static inline void _as_eventHashes(const ezErrEvent *event, size_t underlyingCount, uint64_t *hashes)
+{
+    hashes[kEzErrEventDetail] = _as_textHash(event->detail);
+    hashes[kEzErrEventFunction] = _as_textHash(event->function);
+    hashes[kEzErrEventDomain] = _as_textHash(event->domain);
+    uint64_t underlying = underlyingCount;
+    for (size_t i = 0; i < underlyingCount; i++) {
+        underlying = _as_mix(underlying ^ _as_textHash(event->underlying[i].domain));
+        underlying = _as_mix(underlying ^ (uint64_t)event->underlying[i].code);
+    }
+    hashes[kEzErrEventUnderlying] = underlying;
+    hashes[kEzErrEventUserInfo] = event->userInfo ? _as_hash((const char *)event->userInfo, event->userInfoLength) : 0;
+}
+
+// Both sides step dates by whole microseconds from the last date they agree on, so they never drift apart
+static inline double _as_stepDate(double last, int64_t micros)
+{
+    return last + (double)micros / 1e6;
+}
+
+static inline size_t ezErrEventStreamEncode(ezErrEventStream *stream, const ezErrEvent *event, uint8_t *buffer, size_t capacity)
+{
+    uint64_t site;
+    size_t slot = _as_eventSlot(event->file, event->line, &site);
+    __typeof__(stream->sites[0]) *state = &stream->sites[slot];
+    size_t underlyingCount = event->underlyingCount < kEzErrEventMaxUnderlying ? event->underlyingCount : kEzErrEventMaxUnderlying;
+    uint64_t hashes[kEzErrEventUserInfo + 1] = {0};
+    _as_eventHashes(event, underlyingCount, hashes);
+
+    double dateStep = event->date - state->last.date;
+    if (state->site != site || state->deltas >= kEzErrEventKeyframeInterval || !(fabs(dateStep) < _as_kMaxDateDelta)) {
+        size_t length = ezErrEventEncode(event, buffer, capacity);
+        if (!length) return 0;
+        state->site = site;
+        state->deltas = 0;
+        state->last = *event;
+        memcpy(state->hashes, hashes, sizeof hashes);
+        return length;
+    }
+
+    int64_t micros = (int64_t)llround(dateStep * 1e6);
+    uint32_t changed = 0;
+    if (hashes[kEzErrEventDetail] != state->hashes[kEzErrEventDetail])         changed |= 1u << kEzErrEventDetail;
+    if (hashes[kEzErrEventFunction] != state->hashes[kEzErrEventFunction])     changed |= 1u << kEzErrEventFunction;
+    if (!event->onMainThread != !state->last.onMainThread)                     changed |= 1u << kEzErrEventMainThread;
+    if (micros)                                                                changed |= 1u << kEzErrEventDate;
+    if (hashes[kEzErrEventDomain] != state->hashes[kEzErrEventDomain])         changed |= 1u << kEzErrEventDomain;
+    if (event->code != state->last.code)                                       changed |= 1u << kEzErrEventCode;
+    if (event->errorClass != state->last.errorClass)                           changed |= 1u << kEzErrEventClass;
+    if (!event->firstSeen != !state->last.firstSeen)                           changed |= 1u << kEzErrEventFirstSeen;
+    if (hashes[kEzErrEventUnderlying] != state->hashes[kEzErrEventUnderlying]) changed |= 1u << kEzErrEventUnderlying;
+    if (hashes[kEzErrEventUserInfo] != state->hashes[kEzErrEventUserInfo])     changed |= 1u << kEzErrEventUserInfo;
+
+    // The payload goes after room for the longest byte string head, then moves down once its length is known
+    if (capacity < 9) return 0;
+    _as_cbor_t payload = {buffer + 9, 0, capacity - 9};
+    BOOL fits = _as_varintPut(&payload, slot) && _as_varintPut(&payload, changed);
+    if (fits && (changed & 1u << kEzErrEventDetail))   fits = _as_varintText(&payload, event->detail);
+    if (fits && (changed & 1u << kEzErrEventFunction)) fits = _as_varintText(&payload, event->function);
+    if (fits && (changed & 1u << kEzErrEventDate))     fits = _as_varintPut(&payload, _as_zigzag(micros));
+    if (fits && (changed & 1u << kEzErrEventDomain))   fits = _as_varintText(&payload, event->domain);
+    if (fits && (changed & 1u << kEzErrEventCode))     fits = _as_varintPut(&payload, _as_zigzag((int64_t)((uint64_t)event->code - (uint64_t)state->last.code)));
+    if (fits && (changed & 1u << kEzErrEventClass))    fits = _as_varintPut(&payload, _as_zigzag((int64_t)event->errorClass - state->last.errorClass));
+    if (fits && (changed & 1u << kEzErrEventUnderlying)) {
+        fits = _as_varintPut(&payload, underlyingCount);
+        for (size_t i = 0; fits && i < underlyingCount; i++) {
+            fits = _as_varintText(&payload, event->underlying[i].domain) && _as_varintPut(&payload, _as_zigzag(event->underlying[i].code));
+        }
+    }
+    if (fits && (changed & 1u << kEzErrEventUserInfo)) {
+        fits = _as_varintPut(&payload, event->userInfo ? event->userInfoLength : 0)
+            && _as_cborRaw(&payload, event->userInfo, event->userInfo ? event->userInfoLength : 0);
+    }
+    if (!fits) return 0;
+
+    _as_cbor_t record = {buffer, 0, capacity};
+    _as_cborHead(&record, 2, payload.length);
+    memmove(buffer + record.length, payload.bytes, payload.length);
+
+    double date = _as_stepDate(state->last.date, micros);
+    state->deltas++;
+    state->last = *event;
+    state->last.date = date;
+    memcpy(state->hashes, hashes, sizeof hashes);
+    return record.length + payload.length;
+}
+
+// Applies a delta record to the site's last event. NO if the record is malformed.
+static inline BOOL _as_applyDelta(_as_cborReader_t *in, ezErrEvent *event)
+{
+    uint64_t changed, value;
+    const uint8_t *bytes;
+    size_t length;
+    if (!_as_varintGet(in, &changed) || (changed & ~(uint64_t)_as_kDeltaFields)) return NO;
+
+#define _as_deltaText(key, field) \
+    if (changed & 1u << key) { \
+        if (!_as_varintBytes(in, &bytes, &length)) return NO; \
+        event->field.bytes = (const char *)bytes; \
+        event->field.length = length; \
+    }
+
+    _as_deltaText(kEzErrEventDetail, detail)
+    _as_deltaText(kEzErrEventFunction, function)
+    if (changed & 1u << kEzErrEventMainThread) event->onMainThread = !event->onMainThread;
+    if (changed & 1u << kEzErrEventDate) {
+        if (!_as_varintGet(in, &value)) return NO;
+        event->date = _as_stepDate(event->date, _as_unzigzag(value));
+    }
+    _as_deltaText(kEzErrEventDomain, domain)
+    if (changed & 1u << kEzErrEventCode) {
+        if (!_as_varintGet(in, &value)) return NO;
+        event->code = (int64_t)((uint64_t)event->code + (uint64_t)_as_unzigzag(value));
+    }
+    if (changed & 1u << kEzErrEventClass) {
+        if (!_as_varintGet(in, &value)) return NO;
+        event->errorClass = (ezErrClass)(event->errorClass + _as_unzigzag(value));
+    }
+    if (changed & 1u << kEzErrEventFirstSeen) event->firstSeen = !event->firstSeen;
+    if (changed & 1u << kEzErrEventUnderlying) {
+        if (!_as_varintGet(in, &value) || value > kEzErrEventMaxUnderlying) return NO;
+        event->underlyingCount = (size_t)value;
+        for (size_t i = 0; i < event->underlyingCount; i++) {
+            if (!_as_varintBytes(in, &bytes, &length) || !_as_varintGet(in, &value)) return NO;
+            event->underlying[i].domain.bytes = (const char *)bytes;
+            event->underlying[i].domain.length = length;
+            event->underlying[i].code = _as_unzigzag(value);
+        }
+    }
+    if (changed & 1u << kEzErrEventUserInfo) {
+        if (!_as_varintBytes(in, &bytes, &length)) return NO;
+        event->userInfo = length ? bytes : NULL;
+        event->userInfoLength = length;
+    }
+
+#undef _as_deltaText
+    return in->position == in->length;
+}
+
+static inline size_t ezErrEventStreamDecode(ezErrEventStream *stream, const uint8_t *bytes, size_t length, ezErrEvent *event)
+{
+    size_t position = 0;
+    while (position < length) {
+        _as_cborReader_t reader = {bytes + position, length - position, 0};
+        _as_cborItem item;
+        if (!_as_cborNext(&reader, &item)) return 0;
+
+        if (item.major == 6) {
+            size_t used = ezErrEventDecode(bytes + position, length - position, event);
+            if (!used) return 0;
+            uint64_t site;
+            __typeof__(stream->sites[0]) *state = &stream->sites[_as_eventSlot(event->file, event->line, &site)];
+            state->site = site;
+            state->last = *event;
+            return position + used;
+        }
+        if (item.major != 2) return 0;
+
+        _as_cborReader_t payload = {item.bytes, (size_t)item.value, 0};
+        uint64_t slot;
+        if (!_as_varintGet(&payload, &slot) || slot >= kEzErrEventStreamSites) return 0;
+        position += reader.position;
+        if (!stream->sites[slot].site) continue; // its keyframe came before the reader started
+
+        ezErrEvent next = stream->sites[slot].last;
+        if (!_as_applyDelta(&payload, &next)) return 0;
+        *event = stream->sites[slot].last = next;
+        return position;
+    }
+    return 0;
+}
+
+
+// MARK: - Internal blocks
+
+static const uint32_t _as_crc32cTable[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
+    0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B, 0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24,
+    0x105EC76F, 0xE235446C, 0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC, 0xBC267848, 0x4E4DFB4B,
+    0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A, 0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35,
+    0xAA64D611, 0x580F5512, 0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD, 0x1642AE59, 0xE4292D5A,
+    0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A, 0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595,
+    0x417B1DBC, 0xB3109EBF, 0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F, 0xED03A29B, 0x1F682198,
+    0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927, 0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38,
+    0xDBFC821C, 0x2997011F, 0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E, 0x4767748A, 0xB50CF789,
+    0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859, 0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46,
+    0x7198540D, 0x83F3D70E, 0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE, 0xDDE0EB2A, 0x2F8B6829,
+    0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C, 0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93,
+    0x082F63B7, 0xFA44E0B4, 0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B, 0xB4091BFF, 0x466298FC,
+    0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C, 0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033,
+    0xA24BB5A6, 0x502036A5, 0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975, 0x0E330A81, 0xFC588982,
+    0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D, 0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622,
+    0x38CC2A06, 0xCAA7A905, 0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8, 0xE52CC12C, 0x1747422F,
+    0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF, 0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0,
+    0xD3D3E1AB, 0x21B862A8, 0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78, 0x7FAB5E8C, 0x8DC0DD8F,
+    0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE, 0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1,
+    0x69E9F0D5, 0x9B8273D6, 0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
+    0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
+};
+
+static inline uint32_t _as_crc32cSoftware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    while (length--) crc = _as_crc32cTable[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static inline uint32_t _as_crc32cHardware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    uint64_t wide = crc;
+    for (; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof word);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+    while (length--) crc = _mm_crc32_u8(crc, *bytes++);
+    return crc;
+}
+#define _as_hasCrc32c() __builtin_cpu_supports("sse4.2")
+#elif defined(__ARM_FEATURE_CRC32)
+static inline uint32_t _as_crc32cHardware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    for (; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof word);
+        crc = __crc32cd(crc, word);
+    }
+    while (length--) crc = __crc32cb(crc, *bytes++);
+    return crc;
+}
+#define _as_hasCrc32c() 1
+#else
+#define _as_crc32cHardware _as_crc32cSoftware
+#define _as_hasCrc32c() 0
+#endif
+
+static inline uint32_t ezErrCRC32C(uint32_t crc, const void *bytes, size_t length)
+{
+    crc = ~crc;
+    crc = _as_hasCrc32c() ? _as_crc32cHardware(crc, (const uint8_t *)bytes, length)
+                          : _as_crc32cSoftware(crc, (const uint8_t *)bytes, length);
+    return ~crc;
+}
+
+static inline void _as_put32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint32_t _as_get32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static inline void ezErrBlockHeader(const void *payload, size_t length, uint8_t *header)
+{
+    _as_put32(header, kEzErrBlockMagic);
+    _as_put32(header + 4, (uint32_t)length);
+    _as_put32(header + 8, ezErrCRC32C(ezErrCRC32C(0, header + 4, 4), payload, length));
+}
+
+static inline BOOL ezErrBlockNext(const uint8_t *bytes, size_t length, size_t *offset, ezErrString *payload)
+{
+    for (size_t at = *offset; length >= kEzErrBlockHeaderSize && at <= length - kEzErrBlockHeaderSize; at++) {
+        // The magic's first byte is rare in text, so memchr does most of the skipping
+        const uint8_t *next = (const uint8_t *)memchr(bytes + at, kEzErrBlockMagic & 0xFF, length - kEzErrBlockHeaderSize + 1 - at);
+        if (!next) break;
+        at = (size_t)(next - bytes);
+        if (_as_get32(next) != kEzErrBlockMagic) continue;
+
+        uint32_t size = _as_get32(next + 4);
+        if (size > length - at - kEzErrBlockHeaderSize) continue; // torn, or a corrupted length
+        if (ezErrCRC32C(ezErrCRC32C(0, next + 4, 4), next + kEzErrBlockHeaderSize, size) != _as_get32(next + 8)) continue;
+
+        payload->bytes = (const char *)next + kEzErrBlockHeaderSize;
+        payload->length = size;
+        *offset = at + kEzErrBlockHeaderSize + size;
+        return YES;
+    }
+    return NO;
+}
+
+
+#if defined(__cplusplus) && __cplusplus >= 201402L
+// MARK: - Internal formatted details
+
+// Number of {} placeholders in format, or -1 if a brace is unmatched
+static constexpr int _as_placeholders(const char *format)
+{
+    int count = 0;
+    for (const char *c = format; *c; c++) {
+        if ((*c == '{' || *c == '}') && c[1] == *c) {
+            c++;
+        } else if (*c == '{' && c[1] == '}') {
+            c++;
+            count++;
+        } else if (*c == '{' || *c == '}') {
+            return -1;
+        }
+    }
+    return count;
+}
+
+// Only ever named inside decltype, so the arguments aren't evaluated
+template <typename... Args>
+std::integral_constant<int, sizeof...(Args)> _as_argCount(const Args &...);
+
+#define _as_checkFormat(format, ...)\
+[]{ static_assert(_as_placeholders(format) == decltype(_as_argCount(__VA_ARGS__))::value, "ezErrF: format placeholders don't match the arguments"); }()
+
+// C strings may not outlive the call, so they are copied
+template <typename T> struct _as_captured { typedef T type; };
+template <> struct _as_captured<char *> { typedef std::string type; };
+template <> struct _as_captured<const char *> { typedef std::string type; };
+
+template <typename T> struct _as_formattable {
+#ifdef __OBJC__
+    static const bool value = std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_same<T, std::string>::value || std::is_convertible<T, id>::value;
+#else
+    static const bool value = std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_same<T, std::string>::value;
+#endif
+};
+
+static constexpr bool _as_all(void) { return true; }
+template <typename... Bools>
+static constexpr bool _as_all(bool first, Bools... rest) { return first && _as_all(rest...); }
+
+static inline std::string _as_formatArg(const std::string &value) { return value; }
+static inline std::string _as_formatArg(bool value) { return value ? "true" : "false"; }
+static inline std::string _as_formatArg(char value) { return std::string(1, value); }
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, std::string>::type _as_formatArg(T value)
+{
+    return std::is_signed<T>::value ? std::to_string((long long)value) : std::to_string((unsigned long long)value);
+}
+
+template <typename T>
+static inline typename std::enable_if<std::is_floating_point<T>::value, std::string>::type _as_formatArg(T value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, "%g", (double)value);
+    return buffer;
+}
+
+#ifdef __OBJC__
+static inline std::string _as_formatArg(id value)
+{
+    const char *description = [value description].UTF8String;
+    return description ? description : "(null)";
+}
+#endif
+
+// format was checked at compile time, so every {} has an argument
+template <typename Tuple, size_t... I>
+static inline std::string _as_renderFormat(const char *format, const Tuple &args, std::index_sequence<I...>)
+{
+    std::string parts[sizeof...(I) + 1] = {_as_formatArg(std::get<I>(args))..., std::string()};
+    std::string out;
+    size_t next = 0;
+    for (const char *c = format; *c; c++) {
+        if ((*c == '{' || *c == '}') && c[1] == *c) {
+            out += *c++;
+        } else if (*c == '{') {
+            out += parts[next++];
+            c++;
+        } else {
+            out += *c;
+        }
+    }
+    return out;
+}
+#endif
+
+
+#ifdef __OBJC__
+// MARK: - Internal writer
+
+// Longest a log may sit in a batch before it is written, in seconds. Define before importing ezErr.h to change it.
+#ifndef kEzErrMaxFlushLatency
+#define kEzErrMaxFlushLatency 0.1
+#endif
+
+#define _as_kNearEmptyDepth 2   // at or below this many waiting logs, write right away
+#define _as_kMaxBatch       256
+
+_as_shared NSMutableArray *_as_batch; // only touched on the writer queue
+
+static inline void _as_logErr(NSError *error, NSString *detail, NSString *file, NSString *function, NSString *line, BOOL onMainThread);
+static inline void _as_logErrAt(NSError *error, NSString *detail, const char *file, const char *function, int line);
+
+_as_shared dispatch_queue_t _as_writerQueue(void)
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("ezErr.writer", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+// MARK: - Internal timers
+
+// Every timed job in ezErr (retries, the sink watchdog) runs on one hierarchical timing wheel, owned by the writer queue.
+// Four levels of 64 slots at a 10 ms tick reach 46 hours; later deadlines park in the top level and are re-placed as it turns.
+// Inserting and cancelling are O(1) list operations. A timer cascades down at most once per level before it fires.
+// The ticker isn't periodic: it is set for the earliest deadline, so the process wakes only when a timer is due,
+// and with no timer pending an idle process never wakes up for ezErr.
+
+#define _as_kWheelTickNanos 10000000ull
+#define _as_kWheelBits      6
+#define _as_kWheelSlots     (1 << _as_kWheelBits)
+#define _as_kWheelLevels    4
+
+typedef struct _as_timer {
+    struct _as_timer *next;
+    struct _as_timer *prev;
+    struct _as_timer **list; // slot list the timer is on, NULL if none
+    uint64_t deadline;       // in ticks
+    uint64_t interval;       // in ticks, 0 for a one-shot timer
+    void    *block;          // retained dispatch_block_t, run on a utility queue
+} _as_timer;
+
+typedef struct {
+    uint64_t   tick;
+    uint64_t   pending;
+    _as_timer *slots[_as_kWheelLevels][_as_kWheelSlots];
+} _as_wheel_t;
+
+_as_shared _as_wheel_t _as_wheel; // writer queue only
+_as_shared dispatch_source_t _as_wheelTicker;
+
+static inline uint64_t _as_currentTick(void)
+{
+    return _as_now() / _as_kWheelTickNanos;
+}
+
+static inline void _as_wheelLink(_as_timer *timer)
+{
+    uint64_t delta = timer->deadline > _as_wheel.tick ? timer->deadline - _as_wheel.tick : 0;
+    int level = 0;
+    while (level < _as_kWheelLevels - 1 && delta >= (1ull << (_as_kWheelBits * (level + 1)))) level++;
+
+    uint64_t deadline = timer->deadline;
+    uint64_t reach = 1ull << (_as_kWheelBits * _as_kWheelLevels);
+    if (delta >= reach) deadline = _as_wheel.tick + reach - 1;
+    _as_timer **list = &_as_wheel.slots[level][(deadline >> (_as_kWheelBits * level)) & (_as_kWheelSlots - 1)];
+
+    timer->list = list;
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list) (*list)->prev = timer;
+    *list = timer;
+}
+
+static inline void _as_wheelUnlink(_as_timer *timer)
+{
+    if (!timer->list) return;
+    if (timer->prev) timer->prev->next = timer->next;
+    else *timer->list = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->list = NULL;
+}
+
+static inline void _as_wheelFree(_as_timer *timer)
+{
+    dispatch_block_t block = (__bridge_transfer dispatch_block_t)timer->block;
+    (void)block;
+    free(timer);
+}
+
+// Moves one step: re-places any upper-level slot that has come due, then fires level 0's slot.
+static inline void _as_wheelStep(void)
+{
+    _as_wheel.tick++;
+    for (int level = 1; level < _as_kWheelLevels; level++) {
+        if (_as_wheel.tick & ((1ull << (_as_kWheelBits * level)) - 1)) break;
+        _as_timer **list = &_as_wheel.slots[level][(_as_wheel.tick >> (_as_kWheelBits * level)) & (_as_kWheelSlots - 1)];
+        _as_timer *timer = *list;
+        *list = NULL;
+        while (timer) {
+            _as_timer *next = timer->next;
+            _as_wheelLink(timer);
+            timer = next;
+        }
+    }
+
+    _as_timer **list = &_as_wheel.slots[0][_as_wheel.tick & (_as_kWheelSlots - 1)];
+    _as_timer *timer = *list;
+    *list = NULL;
+    while (timer) {
+        _as_timer *next = timer->next;
+        timer->list = NULL;
+        if (timer->deadline > _as_wheel.tick) {
+            _as_wheelLink(timer); // parked beyond the wheel's reach
+        } else {
+            dispatch_async(dispatch_get_global_queue(_as_kUtilityQoS, 0), (__bridge dispatch_block_t)timer->block);
+            if (timer->interval) {
+                timer->deadline = _as_wheel.tick + timer->interval;
+                _as_wheelLink(timer);
+            } else {
+                _as_wheel.pending--;
+                _as_wheelFree(timer);
+            }
+        }
+        timer = next;
+    }
+}
+
+// The earliest tick with work: a deadline, or for the top level the tick its next full slot cascades, because timers
+// parked beyond the wheel's reach sit there out of order. Below the top, slots hold ever later deadlines,
+// so only each level's first full slot is looked into.
+static inline uint64_t _as_wheelNextDeadline(void)
+{
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < _as_kWheelLevels; level++) {
+        int shift = _as_kWheelBits * level;
+        for (uint64_t i = 1; i <= _as_kWheelSlots; i++) {
+            _as_timer *timer = _as_wheel.slots[level][((_as_wheel.tick >> shift) + i) & (_as_kWheelSlots - 1)];
+            if (!timer) continue;
+            if (level == _as_kWheelLevels - 1) {
+                uint64_t cascade = ((_as_wheel.tick >> shift) + i) << shift;
+                if (cascade < next) next = cascade;
+            }
+            for (; timer && level < _as_kWheelLevels - 1; timer = timer->next) {
+                if (timer->deadline < next) next = timer->deadline;
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+// Moves the wheel to `to`, with no timer due on the way. Upper-level slots that would have cascaded on the way
+// are re-placed from there instead, so skipping ahead costs a few slot looks however far it goes.
+static inline void _as_wheelJump(uint64_t to)
+{
+    _as_timer *moved = NULL;
+    for (int level = 1; level < _as_kWheelLevels; level++) {
+        int shift = _as_kWheelBits * level;
+        uint64_t passed = (to >> shift) - (_as_wheel.tick >> shift);
+        if (passed > _as_kWheelSlots) passed = _as_kWheelSlots;
+        for (uint64_t i = 1; i <= passed; i++) {
+            _as_timer **list = &_as_wheel.slots[level][((_as_wheel.tick >> shift) + i) & (_as_kWheelSlots - 1)];
+            while (*list) {
+                _as_timer *timer = *list;
+                *list = timer->next;
+                timer->next = moved;
+                moved = timer;
+            }
+        }
+    }
+    _as_wheel.tick = to;
+    while (moved) {
+        _as_timer *next = moved->next;
+        _as_wheelLink(moved);
+        moved = next;
+    }
+}
+
+// Wakes happen only at deadlines, so this is usually one jump and one step
+static inline void _as_wheelAdvance(void)
+{
+    uint64_t target = _as_currentTick();
+    while (_as_wheel.tick < target) {
+        uint64_t next = _as_wheel.pending ? _as_wheelNextDeadline() : UINT64_MAX;
+        if (next > target) {
+            _as_wheelJump(target);
+            break;
+        }
+        _as_wheelJump(next - 1);
+        _as_wheelStep();
+    }
+}
+
+static inline void _as_wheelArm(void)
+{
+    if (!_as_wheel.pending) {
+        dispatch_source_set_timer(_as_wheelTicker, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+    uint64_t due = _as_wheelNextDeadline() * _as_kWheelTickNanos, now = _as_now();
+    dispatch_source_set_timer(_as_wheelTicker, dispatch_time(DISPATCH_TIME_NOW, due > now ? (int64_t)(due - now) : 0),
+                              DISPATCH_TIME_FOREVER, _as_kWheelTickNanos / 2);
+}
+
+// Passes back a handle for _as_timerCancel, or NULL if it couldn't allocate one and the block will never run.
+// One-shot handles are only valid until the timer fires.
+static inline _as_timer *_as_timerAdd(double delay, double interval, dispatch_block_t block)
+{
+    _as_timer *timer = (_as_timer *)calloc(1, sizeof(_as_timer));
+    if (!timer) return NULL;
+    timer->block = (__bridge_retained void *)[block copy];
+    uint64_t delayTicks = (uint64_t)(delay * 1e9) / _as_kWheelTickNanos;
+    timer->interval = (uint64_t)(interval * 1e9) / _as_kWheelTickNanos;
+    if (interval > 0 && !timer->interval) timer->interval = 1;
+
+    dispatch_async(_as_writerQueue(), ^{
+        if (!_as_wheelTicker) {
+            _as_wheel.tick = _as_currentTick();
+            _as_wheelTicker = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _as_writerQueue());
+            dispatch_source_set_event_handler(_as_wheelTicker, ^{
+                _as_wheelAdvance();
+                _as_wheelArm();
+            });
+            dispatch_source_set_timer(_as_wheelTicker, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+            dispatch_resume(_as_wheelTicker);
+        } else {
+            _as_wheelAdvance(); // catch up before measuring the delay from now
+        }
+
+        timer->deadline = _as_wheel.tick + (delayTicks ? delayTicks : 1);
+        _as_wheelLink(timer);
+        _as_wheel.pending++;
+        _as_wheelArm();
+    });
+    return timer;
+}
+
+static inline void _as_timerCancel(_as_timer *timer)
+{
+    dispatch_async(_as_writerQueue(), ^{
+        if (!timer->list) return;
+        _as_wheelUnlink(timer);
+        _as_wheelFree(timer);
+        _as_wheel.pending--;
+        _as_wheelArm();
+    });
+}
+
+
+// MARK: - Internal sinks
+
+// Seconds a single file write may take before the watchdog fails over. Define before importing ezErr.h to change it.
+#ifndef kEzErrSinkStallTimeout
+#define kEzErrSinkStallTimeout 2.0
+#endif
+
+#define _as_kSinkErrorsBeforeFailover 3
+#define _as_kMemorySinkLogs           256
+
+_as_shared int _as_logFile = -1;
+_as_shared int _as_logFileBlocks;
+_as_shared int _as_fallbackSink = kEzErrSinkStderr;
+_as_shared NSMutableArray *_as_memorySink; // only touched on the writer queue
+_as_shared _as_timer *_as_watchdog;
+
+// File writes get their own queue so a hung write can't stall the writer queue behind it
+_as_shared dispatch_queue_t _as_fileQueue(void)
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("ezErr.file", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+static inline void _as_recordSinkWrite(ezErrSinkStats *sink, uint64_t latency, BOOL ok)
+{
+    _as_statsStripe *stripe = _as_statsBegin();
+    __atomic_fetch_add(ok ? &sink->writes : &sink->errors, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sink->lastLatencyNanos, latency, __ATOMIC_RELAXED);
+    if (latency > __atomic_load_n(&sink->maxLatencyNanos, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&sink->maxLatencyNanos, latency, __ATOMIC_RELAXED);
+    }
+    _as_statsEnd(stripe);
+}
+
+static inline BOOL _as_writeBytes(int fd, const char *bytes, size_t left)
+{
+    while (left > 0) {
+        ssize_t written = write(fd, bytes, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        bytes += written;
+        left -= written;
+    }
+    return YES;
+}
+
+static inline BOOL _as_writeAll(int fd, NSString *text)
+{
+    NSData *data = [text dataUsingEncoding:NSUTF8StringEncoding];
+    return _as_writeBytes(fd, (const char *)data.bytes, data.length);
+}
+
+// A log file written in preallocated segments. File queue only.
+typedef struct {
+    int      fd;            // the file this describes, -1 for none
+    size_t   segmentBytes;  // 0: a plain O_APPEND file
+    BOOL     direct;        // O_DIRECT: whole aligned blocks only
+    off_t    end;           // where the next write goes
+    off_t    reserved;      // the file's size, preallocated up to here
+    uint8_t *buffer;        // direct only, aligned. Starts with the bytes already written in end's block.
+    size_t   capacity;
+} _as_segment_t;
+
+_as_shared size_t _as_segmentBytes;
+_as_shared int _as_segmentDirect;
+_as_shared _as_segment_t _as_segment = {-1, 0, NO, 0, 0, NULL, 0};
+
+static inline BOOL _as_pwriteAll(int fd, const uint8_t *bytes, size_t left, off_t offset)
+{
+    while (left > 0) {
+        ssize_t written = pwrite(fd, bytes, left, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        bytes += written;
+        offset += written;
+        left -= written;
+    }
+    return YES;
+}
+
+// Grows the file to `to` with its blocks allocated up front
+static inline BOOL _as_reserve(int fd, off_t from, off_t to)
+{
+#ifdef __APPLE__
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, to - from, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) < 0) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) < 0) return NO;
+    }
+    return ftruncate(fd, to) == 0;
+#else
+    return posix_fallocate(fd, from, to - from) == 0;
+#endif
+}
+
+// Cuts the unused reserve off the file that was being written
+static inline void _as_segmentClose(void)
+{
+    if (_as_segment.fd >= 0 && _as_segment.segmentBytes) (void)ftruncate(_as_segment.fd, _as_segment.end);
+    free(_as_segment.buffer);
+    memset(&_as_segment, 0, sizeof _as_segment);
+    _as_segment.fd = -1;
+}
+
+// A reserve left by a crash reads as zeros, and no log ends in a zero byte, so the next write goes after the last one
+static inline off_t _as_logicalEnd(int fd, off_t end)
+{
+    uint8_t chunk[4096];
+    while (end > 0) {
+        size_t length = end < (off_t)sizeof chunk ? (size_t)end : sizeof chunk;
+        if (pread(fd, chunk, length, end - length) != (ssize_t)length) break;
+        while (length > 0 && chunk[length - 1] == 0) {
+            length--;
+            end--;
+        }
+        if (length) break;
+    }
+    return end;
+}
+
+static inline void _as_segmentOpen(int fd)
+{
+    _as_segmentClose();
+    _as_segment.fd = fd;
+    if (fcntl(fd, F_GETFL) & O_APPEND) return;
+
+    _as_segment.segmentBytes = _as_segmentBytes ? _as_segmentBytes : kEzErrLogFileAlignment;
+    _as_segment.reserved = lseek(fd, 0, SEEK_END);
+    _as_segment.end = _as_logicalEnd(fd, _as_segment.reserved);
+    if (!__atomic_load_n(&_as_segmentDirect, __ATOMIC_RELAXED)) return;
+
+#if defined(O_DIRECT)
+    size_t head = (size_t)(_as_segment.end % kEzErrLogFileAlignment);
+    if (posix_memalign((void **)&_as_segment.buffer, kEzErrLogFileAlignment, kEzErrLogFileAlignment) != 0) return;
+    _as_segment.capacity = kEzErrLogFileAlignment;
+    // Read the partial block while the page cache can still serve it, then switch. Filesystems without O_DIRECT refuse here.
+    if (pread(fd, _as_segment.buffer, head, _as_segment.end - head) == (ssize_t)head
+        && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0) {
+        _as_segment.direct = YES;
+    }
+#elif defined(F_NOCACHE)
+    fcntl(fd, F_NOCACHE, 1); // no alignment rules, so plain writes
+#endif
+}
+
+// O_DIRECT writes whole blocks: the block end is in is written again, with what it already holds in front
+static inline BOOL _as_directWrite(int fd, const uint8_t *bytes, size_t length)
+{
+    size_t head = (size_t)(_as_segment.end % kEzErrLogFileAlignment);
+    size_t used = head + length;
+    size_t size = (used + kEzErrLogFileAlignment - 1) / kEzErrLogFileAlignment * kEzErrLogFileAlignment;
+    if (size > _as_segment.capacity) {
+        uint8_t *buffer;
+        if (posix_memalign((void **)&buffer, kEzErrLogFileAlignment, size) != 0) return NO;
+        memcpy(buffer, _as_segment.buffer, head);
+        free(_as_segment.buffer);
+        _as_segment.buffer = buffer;
+        _as_segment.capacity = size;
+    }
+    memcpy(_as_segment.buffer + head, bytes, length);
+    memset(_as_segment.buffer + used, 0, size - used);
+    if (!_as_pwriteAll(fd, _as_segment.buffer, size, _as_segment.end - head)) return NO;
+
+    size_t partial = used / kEzErrLogFileAlignment * kEzErrLogFileAlignment;
+    memmove(_as_segment.buffer, _as_segment.buffer + partial, used - partial);
+    return YES;
+}
+
+static inline BOOL _as_fileWrite(int fd, const uint8_t *bytes, size_t length)
+{
+    if (_as_segment.fd != fd) _as_segmentOpen(fd);
+    if (!_as_segment.segmentBytes) return _as_writeBytes(fd, (const char *)bytes, length);
+
+    off_t end = _as_segment.end + (off_t)length;
+    if (end > _as_segment.reserved) {
+        off_t segment = (off_t)_as_segment.segmentBytes;
+        off_t to = (end + segment - 1) / segment * segment;
+        // Without a reserve the write still grows the file, just the slow way
+        if (_as_reserve(fd, _as_segment.reserved, to)) _as_segment.reserved = to;
+    }
+
+    BOOL ok = _as_segment.direct ? _as_directWrite(fd, bytes, length) : _as_pwriteAll(fd, bytes, length, _as_segment.end);
+    if (ok) _as_segment.end = end;
+    return ok;
+}
+
+// The header and payload go out in one write, so a crash tears at most this block
+static inline NSData *_as_logFileData(NSString *text)
+{
+    NSData *payload = [[text stringByAppendingString:@"\n"] dataUsingEncoding:NSUTF8StringEncoding];
+    if (!__atomic_load_n(&_as_logFileBlocks, __ATOMIC_RELAXED)) return payload;
+
+    NSMutableData *block = [NSMutableData dataWithLength:kEzErrBlockHeaderSize];
+    ezErrBlockHeader(payload.bytes, payload.length, (uint8_t *)block.mutableBytes);
+    [block appendData:payload];
+    return block;
+}
+
+// Once only per ezErrSetLogFile. The self-event is logged like any other error, so it lands on the fallback sink.
+static inline void _as_failOver(NSString *reason)
+{
+    uint64_t expected = 0;
+    if (!__atomic_compare_exchange_n(&_as_stats.failedOver, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+
+    NSError *event = [NSError errorWithDomain:kEzErrSelfDomain
+                                         code:kEzErrSelfSinkFailedOver
+                                     userInfo:@{NSLocalizedDescriptionKey : reason}];
+    _as_convertForLog(event, @"Log file failed over to the fallback sink");
+}
+
+// Writer queue only
+static inline void _as_writeFallback(NSString *text)
+{
+    uint64_t start = _as_now();
+    switch (_as_fallbackSink) {
+        case kEzErrSinkConsole:
+            NSLog(@"%@", text);
+            break;
+        case kEzErrSinkMemory:
+            if (!_as_memorySink) _as_memorySink = [NSMutableArray new];
+            [_as_memorySink addObject:text];
+            _as_memoryCharge(kEzErrMemoryRecentLogs, text.length * sizeof(unichar));
+            if (_as_memorySink.count > _as_kMemorySinkLogs) {
+                _as_memoryRelease(kEzErrMemoryRecentLogs, [_as_memorySink[0] length] * sizeof(unichar));
+                [_as_memorySink removeObjectAtIndex:0];
+            }
+            break;
+        default:
+            _as_writeAll(STDERR_FILENO, [text stringByAppendingString:@"\n"]);
+            break;
+    }
+    _as_recordSinkWrite(&_as_stats.fallbackSink, _as_now() - start, YES);
+}
+
+static inline void _as_writeFile(NSString *text)
+{
+    uint64_t bytes = text.length * sizeof(unichar);
+    _as_memoryCharge(kEzErrMemoryQueued, bytes);
+    dispatch_async(_as_fileQueue(), ^{
+        _as_memoryRelease(kEzErrMemoryQueued, bytes);
+
+        int fd = __atomic_load_n(&_as_logFile, __ATOMIC_ACQUIRE);
+        if (fd < 0 || __atomic_load_n(&_as_stats.failedOver, __ATOMIC_ACQUIRE)) {
+            // Sink changed while this write was queued
+            dispatch_async(_as_writerQueue(), ^{
+                if (fd < 0) NSLog(@"%@", text);
+                else _as_writeFallback(text);
+            });
+            return;
+        }
+
+        NSData *data = _as_logFileData(text);
+        uint64_t start = _as_now();
+        __atomic_store_n(&_as_stats.fileWriteStartNanos, start, __ATOMIC_RELEASE);
+        BOOL ok = _as_fileWrite(fd, (const uint8_t *)data.bytes, data.length);
+        int writeErrno = errno;
+        __atomic_store_n(&_as_stats.fileWriteStartNanos, 0, __ATOMIC_RELEASE);
+        _as_recordSinkWrite(&_as_stats.fileSink, _as_now() - start, ok);
+
+        if (ok) {
+            _as_stats.fileErrorsInARow = 0;
+        } else if (++_as_stats.fileErrorsInARow >= _as_kSinkErrorsBeforeFailover) {
+            _as_failOver([NSString stringWithFormat:@"Log file writes failing: %s", strerror(writeErrno)]);
+        }
+    });
+}
+
+static inline BOOL _as_fileWriteStalled(void)
+{
+    uint64_t start = __atomic_load_n(&_as_stats.fileWriteStartNanos, __ATOMIC_ACQUIRE);
+    return start && _as_now() - start >= (uint64_t)(kEzErrSinkStallTimeout * 1e9);
+}
+
+// The watchdog only looks at the file queue from outside, so it notices writes that never return.
+static inline void _as_startWatchdog(void)
+{
+    _as_watchdog = _as_timerAdd(1.0, 1.0, ^{
+        if (_as_fileWriteStalled()) _as_failOver(@"Log file write stalled");
+    });
+}
+
+static inline BOOL ezErrSetLogFile(NSString *path)
+{
+    int fd = -1;
+    if (path) {
+        if (_as_fileWriteStalled()) return NO;
+        // Segments are written in place, and read back at open to find where the last run stopped
+        int mode = __atomic_load_n(&_as_segmentBytes, __ATOMIC_RELAXED) ? O_RDWR : O_WRONLY | O_APPEND;
+        fd = open(path.fileSystemRepresentation, mode | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return NO;
+    }
+
+    dispatch_async(_as_writerQueue(), ^{
+        // The watchdog only runs while there is a file to watch
+        if (fd >= 0 && !_as_watchdog) _as_startWatchdog();
+        if (fd < 0 && _as_watchdog) {
+            _as_timerCancel(_as_watchdog);
+            _as_watchdog = NULL;
+        }
+        int old = __atomic_exchange_n(&_as_logFile, fd, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&_as_stats.failedOver, 0, __ATOMIC_RELEASE);
+        // Close behind any writes still queued for the old file
+        if (old >= 0) dispatch_async(_as_fileQueue(), ^{
+            if (_as_segment.fd == old) _as_segmentClose();
+            close(old);
+        });
+    });
+    return YES;
+}
+
+static inline void ezErrSetLogFileSegments(size_t segmentBytes, BOOL direct)
+{
+    __atomic_store_n(&_as_segmentBytes, segmentBytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&_as_segmentDirect, direct ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static inline void ezErrSetLogFileBlocks(BOOL on)
+{
+    __atomic_store_n(&_as_logFileBlocks, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static inline void ezErrSetFallbackSink(ezErrSink sink)
+{
+    dispatch_async(_as_writerQueue(), ^{
+        _as_fallbackSink = sink;
+    });
+}
+
+static inline NSArray *ezErrRecentLogs(void)
+{
+    __block NSArray *logs;
+    dispatch_sync(_as_writerQueue(), ^{
+        logs = [_as_memorySink copy] ?: @[];
+    });
+    return logs;
+}
+
+// Writer queue only
+static inline void _as_writeSink(NSString *text)
+{
+    if (__atomic_load_n(&_as_stats.failedOver, __ATOMIC_ACQUIRE)) {
+        _as_writeFallback(text);
+    } else if (__atomic_load_n(&_as_logFile, __ATOMIC_ACQUIRE) >= 0) {
+        _as_writeFile(text);
+    } else {
+        NSLog(@"%@", text);
+    }
+}
+
+
+static inline void _as_flush(ezErrFlushMode mode, uint64_t target)
+{
+    uint64_t size = _as_batch.count;
+    if (size == 0) return;
+
+    // One write for the whole batch
+    NSString *text = [_as_batch componentsJoinedByString:@""];
+    _as_writeSink(text);
+    [_as_batch removeAllObjects];
+    _as_memoryRelease(kEzErrMemoryQueued, text.length * sizeof(unichar));
+
+    _as_statsStripe *stripe = _as_statsBegin();
+    __atomic_store_n(&_as_stats.flushMode, mode, __ATOMIC_RELAXED);
+    __atomic_store_n(&_as_stats.batchTarget, target, __ATOMIC_RELAXED);
+    __atomic_store_n(&_as_stats.lastBatchSize, size, __ATOMIC_RELAXED);
+    if (size > _as_stats.maxBatchSize) __atomic_store_n(&_as_stats.maxBatchSize, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_as_stats.flushCount, 1, __ATOMIC_RELAXED);
+    _as_statsEnd(stripe);
+}
+
+// Runs on the writer queue once per log. The backlog still queued behind this log decides the policy:
+// near-empty writes immediately for latency, a deeper backlog aims for batches of half its size for throughput.
+// The last log of any burst sees an empty queue and flushes, and nothing waits longer than kEzErrMaxFlushLatency.
+static inline void _as_writeLog(NSString *log)
+{
+    uint64_t depth = __atomic_sub_fetch(&_as_stats.queueDepth, 1, __ATOMIC_RELAXED);
+    uint64_t now = _as_now();
+
+    if (!_as_batch) _as_batch = [NSMutableArray new];
+    if (_as_batch.count == 0) _as_stats.oldestNanos = now;
+    [_as_batch addObject:log];
+
+    uint64_t target = depth / 2;
+    if (target < 1) target = 1;
+    if (target > _as_kMaxBatch) target = _as_kMaxBatch;
+
+    BOOL nearEmpty = depth <= _as_kNearEmptyDepth;
+    BOOL overdue = now - _as_stats.oldestNanos >= (uint64_t)(kEzErrMaxFlushLatency * 1e9);
+    if (nearEmpty || overdue || _as_batch.count >= target) {
+        _as_flush(nearEmpty ? kEzErrFlushImmediate : kEzErrFlushBatched, target);
+    }
+}
+
+static inline void _as_templatesReset(void);
+static inline void _as_repeatEvict(void);
+
+// Frees the older half of the memory sink and every mined template on the writer queue. At most one pass is queued
+// at a time, and what it will free counts as gone from the moment it is queued.
+static inline void _as_memoryReclaim(void)
+{
+    uint64_t sinkBytes = (__atomic_load_n(&_as_stats.memoryUsage[kEzErrMemoryRecentLogs], __ATOMIC_RELAXED) + 1) / 2;
+    uint64_t freeing = sinkBytes + __atomic_load_n(&_as_stats.memoryUsage[kEzErrMemoryTemplates], __ATOMIC_RELAXED);
+    uint64_t expected = 0;
+    if (!freeing || !__atomic_compare_exchange_n(&_as_stats.reclaimPending, &expected, freeing, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+
+    dispatch_async(_as_writerQueue(), ^{
+        uint64_t freed = 0;
+        NSUInteger drop = 0;
+        while (drop < _as_memorySink.count && freed < sinkBytes) {
+            freed += [_as_memorySink[drop++] length] * sizeof(unichar);
+        }
+        _as_memoryRelease(kEzErrMemoryRecentLogs, freed);
+        [_as_memorySink removeObjectsInRange:NSMakeRange(0, drop)];
+        _as_templatesReset();
+        __atomic_store_n(&_as_stats.reclaimPending, 0, __ATOMIC_RELEASE);
+    });
+}
+
+// What is held once a queued reclaim pass has run
+static inline uint64_t _as_memoryAfterReclaim(void)
+{
+    uint64_t total = _as_memoryTotal(), pending = __atomic_load_n(&_as_stats.reclaimPending, __ATOMIC_ACQUIRE);
+    return total > pending ? total - pending : 0;
+}
+
+// Passes back NO if a log of this size has to be dropped to stay under budget.
+// Before that, every thread's repeat cache is emptied, then the memory sink and the templates are shrunk.
+static inline BOOL _as_memoryAdmit(uint64_t bytes)
+{
+    uint64_t budget = __atomic_load_n(&_as_memoryBudget, __ATOMIC_RELAXED);
+    if (!budget || _as_memoryTotal() + bytes <= budget) return YES;
+    if (_as_memoryAfterReclaim() + bytes <= budget) return YES;
+
+    _as_repeatEvict();
+    if (_as_memoryAfterReclaim() + bytes <= budget) return YES;
+
+    _as_memoryReclaim();
+    return _as_memoryAfterReclaim() + bytes <= budget;
+}
+
+static inline void _as_enqueueLog(NSString *log)
+{
+    uint64_t bytes = log.length * sizeof(unichar);
+    if (!_as_memoryAdmit(bytes)) {
+        __atomic_fetch_add(&_as_stats.droppedLogs, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    _as_memoryCharge(kEzErrMemoryQueued, bytes);
+
+    __atomic_fetch_add(&_as_stats.queueDepth, 1, __ATOMIC_RELAXED);
+    dispatch_async(_as_writerQueue(), ^{
+        _as_writeLog(log);
+    });
+}
+
+
+typedef NSString *(^_as_render_t)(void);
+
+// For logs rendered on the writer: one reservation for the lot. estimate is charged up front
+// and trued up once the logs exist.
+static inline void _as_enqueueRenders(uint64_t estimate, NSArray *renders)
+{
+    if (!_as_memoryAdmit(estimate)) {
+        __atomic_fetch_add(&_as_stats.droppedLogs, renders.count, __ATOMIC_RELAXED);
+        return;
+    }
+    _as_memoryCharge(kEzErrMemoryQueued, estimate);
+
+    __atomic_fetch_add(&_as_stats.queueDepth, renders.count, __ATOMIC_RELAXED);
+    dispatch_async(_as_writerQueue(), ^{
+        for (_as_render_t render in renders) {
+            NSString *log = render();
+            _as_memoryCharge(kEzErrMemoryQueued, log.length * sizeof(unichar));
+            _as_writeLog(log);
+        }
+        _as_memoryRelease(kEzErrMemoryQueued, estimate);
+    });
+}
+
+static inline void _as_enqueueRender(uint64_t estimate, _as_render_t render)
+{
+    _as_enqueueRenders(estimate, @[render]);
+}
+
+
+static inline void _as_reportAnomaly(ezErrSelfCode code, NSString *detail, double rate, double mean, double sigma)
+{
+    NSError *anomaly = [NSError errorWithDomain:kEzErrSelfDomain
+                                           code:code
+                                       userInfo:@{NSLocalizedDescriptionKey : detail,
+                                                  kEzErrAnomalyRateKey      : @(rate),
+                                                  kEzErrAnomalyMeanKey      : @(mean),
+                                                  kEzErrAnomalySigmaKey     : @(sigma)}];
+    _as_convertForLog(anomaly, detail);
+}
+
+
+// MARK: - Internal retry
+
+// Full jitter: anywhere between 0 and the exponential cap
+// glibc only has arc4random from 2.36. Elsewhere, a per-thread splitmix seeded from the clock is plenty for jitter.
+static inline uint32_t _as_random(uint32_t bound)
+{
+#if defined(__APPLE__) || defined(__FreeBSD__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 36))
+    return arc4random_uniform(bound);
+#else
+    static __thread uint64_t state;
+    if (!state) state = _as_now() ^ (uint64_t)(uintptr_t)&state;
+    state += 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(_as_mix(state) % bound);
+#endif
+}
+
+static inline double _as_backoff(NSUInteger attempt)
+{
+    double cap = kEzErrRetryBaseDelay * (double)(1ull << (attempt < 32 ? attempt : 32));
+    if (cap > kEzErrRetryMaxDelay) cap = kEzErrRetryMaxDelay;
+    return cap * _as_random(1 << 20) / (double)(1 << 20);
+}
+
+// Site strings are literals, so the blocks keep them as plain pointers
+static inline void _as_retryAttempt(NSString *detail, ezErrRetryOperation operation, ezErrRetryCompletion completion,
+                                    const char *file, const char *function, int line, NSUInteger attempt)
+{
+    operation(attempt, ^(NSError *error) {
+        if (!_as_isError(error)) {
+            if (completion) completion(nil);
+            return;
+        }
+
+        // The same path as the macros: its own pool, the repeat cache and the current scope
+        @autoreleasepool {
+            _as_logErrAt(error, [NSString stringWithFormat:@"%@ (attempt %lu of %d)", detail ?: @"No detail", (unsigned long)attempt, kEzErrRetryMaxAttempts],
+                         file, function, line);
+        }
+
+        ezErrClass errorClass = _as_classOf(error);
+        if (attempt >= kEzErrRetryMaxAttempts || errorClass == kEzErrClassFatal || errorClass == kEzErrClassUserFacing) {
+            if (completion) completion(error);
+            return;
+        }
+        _as_timer *next = _as_timerAdd(_as_backoff(attempt), 0, ^{
+            _as_retryAttempt(detail, operation, completion, file, function, line, attempt + 1);
+        });
+        if (!next && completion) completion(error); // no retry can be scheduled
+    });
+}
+
+static inline void _as_retry(const char *file, const char *function, int line,
+                             NSString *detail, ezErrRetryOperation operation, ezErrRetryCompletion completion)
+{
+    _as_retryAttempt(detail, operation, completion, file, function, line, 1);
+}
+
+
+// MARK: - Internal templates
+
+#define _as_kTemplateMaxChildren 64 // children per tree node before new tokens share the <*> branch
+
+_as_shared int _as_templateMining;
+_as_shared NSMutableDictionary *_as_templateTree;  // writer queue only
+_as_shared NSMutableArray *_as_templates;          // writer queue only, oldest first
+_as_shared uint64_t _as_templateLastID;            // writer queue only. IDs aren't reused after a reset.
+
+static inline void ezErrSetTemplateMining(BOOL on)
+{
+    __atomic_store_n(&_as_templateMining, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static inline BOOL _as_hasDigit(NSString *token)
+{
+    return [token rangeOfCharacterFromSet:[NSCharacterSet decimalDigitCharacterSet]].location != NSNotFound;
+}
+
+// The leaf for masked tokens. Its groups are under the NSNull key, which no token can collide with.
+static inline NSMutableArray *_as_templateLeaf(NSArray *tokens)
+{
+    if (!_as_templateTree) _as_templateTree = [NSMutableDictionary new];
+    NSMutableDictionary *node = _as_templateTree[@(tokens.count)];
+    if (!node) node = _as_templateTree[@(tokens.count)] = [NSMutableDictionary new];
+
+    for (NSUInteger depth = 0; depth + 2 < kEzErrTemplateDepth && depth < tokens.count; depth++) {
+        NSString *key = tokens[depth];
+        NSMutableDictionary *child = node[key];
+        if (!child && node.count >= _as_kTemplateMaxChildren) child = node[key = @"<*>"];
+        if (!child) child = node[key] = [NSMutableDictionary new];
+        node = child;
+    }
+
+    NSMutableArray *groups = node[[NSNull null]];
+    if (!groups) groups = node[[NSNull null]] = [NSMutableArray new];
+    return groups;
+}
+
+// Renders detail as its pattern ID and variable tokens, plus the pattern's text if it is new or just widened.
+// Passes back detail unchanged if it has no tokens or the pattern table is full. Writer queue only.
+static inline NSString *_as_templateDetail(NSString *detail)
+{
+    // Tokens with digits in them are taken to be variable from the start
+    NSMutableArray *tokens = [NSMutableArray new], *masked = [NSMutableArray new];
+    for (NSString *token in [detail componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]]) {
+        if (!token.length) continue;
+        [tokens addObject:token];
+        [masked addObject:_as_hasDigit(token) ? @"<*>" : token];
+    }
+    if (tokens.count == 0) return detail;
+
+    NSMutableArray *groups = _as_templateLeaf(masked);
+    NSMutableDictionary *best = nil;
+    double bestSimilarity = -1;
+    for (NSMutableDictionary *group in groups) {
+        NSArray *pattern = group[kEzErrTemplateKey];
+        NSUInteger same = 0;
+        for (NSUInteger i = 0; i < tokens.count; i++) same += [pattern[i] isEqualToString:masked[i]];
+        double similarity = (double)same / tokens.count;
+        if (similarity > bestSimilarity) {
+            best = group;
+            bestSimilarity = similarity;
+        }
+    }
+
+    BOOL changed = NO;
+    if (best && bestSimilarity >= kEzErrTemplateSimilarity) {
+        NSMutableArray *pattern = best[kEzErrTemplateKey];
+        for (NSUInteger i = 0; i < tokens.count; i++) {
+            if (![pattern[i] isEqualToString:@"<*>"] && ![pattern[i] isEqualToString:masked[i]]) {
+                pattern[i] = @"<*>";
+                changed = YES;
+            }
+        }
+        best[kEzErrTemplateCountKey] = @([best[kEzErrTemplateCountKey] unsignedLongLongValue] + 1);
+    } else {
+        if (!_as_templates) _as_templates = [NSMutableArray new];
+        if (_as_templates.count >= kEzErrMaxTemplates) return detail;
+
+        best = [@{kEzErrTemplateIDKey    : @(++_as_templateLastID),
+                  kEzErrTemplateKey      : masked,
+                  kEzErrTemplateCountKey : @1} mutableCopy];
+        [groups addObject:best];
+        [_as_templates addObject:best];
+        _as_memoryCharge(kEzErrMemoryTemplates, detail.length * sizeof(unichar) + 32 * tokens.count);
+        changed = YES;
+    }
+
+    NSArray *pattern = best[kEzErrTemplateKey];
+    NSMutableArray *variables = [NSMutableArray new];
+    for (NSUInteger i = 0; i < tokens.count; i++) {
+        if ([pattern[i] isEqualToString:@"<*>"]) [variables addObject:tokens[i]];
+    }
+
+    NSMutableString *shown = [NSMutableString stringWithFormat:@"T%@ [%@]", best[kEzErrTemplateIDKey], [variables componentsJoinedByString:@", "]];
+    if (changed) [shown appendFormat:@"\n* Template      : T%@ %@", best[kEzErrTemplateIDKey], [pattern componentsJoinedByString:@" "]];
+    return shown;
+}
+
+// Lets every template go, to make room under the memory budget. Writer queue only.
+static inline void _as_templatesReset(void)
+{
+    _as_templates = nil;
+    _as_templateTree = nil;
+    _as_memoryRelease(kEzErrMemoryTemplates, __atomic_load_n(&_as_stats.memoryUsage[kEzErrMemoryTemplates], __ATOMIC_RELAXED));
+}
+
+static inline NSString *_as_minedDetail(NSString *detail)
+{
+    return __atomic_load_n(&_as_templateMining, __ATOMIC_RELAXED) ? _as_templateDetail(detail) : detail;
+}
+
+static inline NSArray *ezErrTemplates(void)
+{
+    NSMutableArray *templates = [NSMutableArray new];
+    dispatch_sync(_as_writerQueue(), ^{
+        for (NSDictionary *group in _as_templates) {
+            [templates addObject:@{kEzErrTemplateIDKey    : group[kEzErrTemplateIDKey],
+                                   kEzErrTemplateKey      : [group[kEzErrTemplateKey] componentsJoinedByString:@" "],
+                                   kEzErrTemplateCountKey : group[kEzErrTemplateCountKey]}];
+        }
+    });
+    [templates sortUsingComparator:^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
+        return [b[kEzErrTemplateCountKey] compare:a[kEzErrTemplateCountKey]];
+    }];
+    return templates;
+}
+
+
+// MARK: - Internal user info
+
+_as_shared void *_as_userInfoKeys; // NSArray, retained and never released
+
+static inline void ezErrSetUserInfoKeys(NSArray *keys)
+{
+    __atomic_store_n(&_as_userInfoKeys, keys ? _as_bridgeRetained([keys copy]) : NULL, __ATOMIC_RELEASE);
+}
+
+// GNUstep Base doesn't declare NSDebugDescriptionErrorKey
+#ifdef GNUSTEP
+#define _as_kDebugDescriptionKey @"NSDebugDescription"
+#else
+#define _as_kDebugDescriptionKey NSDebugDescriptionErrorKey
+#endif
+
+static inline NSArray *_as_allowedUserInfoKeys(void)
+{
+    void *keys = __atomic_load_n(&_as_userInfoKeys, __ATOMIC_ACQUIRE);
+    if (keys) return _as_bridge(NSArray *, keys);
+
+    static NSArray *defaults;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        defaults = @[NSUnderlyingErrorKey, NSFilePathErrorKey, NSURLErrorFailingURLErrorKey,
+                     NSLocalizedFailureReasonErrorKey, _as_kDebugDescriptionKey];
+    });
+    return defaults;
+}
+
+static inline BOOL _as_cborObject(_as_cbor_t *cbor, id value, int depth);
+
+// Converts no more than kEzErrUserInfoMaxString bytes, however long the string is
+static inline BOOL _as_cborNSString(_as_cbor_t *cbor, NSString *text)
+{
+    char utf8[kEzErrUserInfoMaxString];
+    NSUInteger used = 0;
+    [text getBytes:utf8 maxLength:sizeof utf8 usedLength:&used encoding:NSUTF8StringEncoding
+           options:NSStringEncodingConversionAllowLossy range:NSMakeRange(0, text.length) remainingRange:NULL];
+    return _as_cborString(cbor, 3, utf8, used, sizeof utf8);
+}
+
+// A map of the allowed keys present in userInfo. Entries that don't fit are left out.
+static inline BOOL _as_cborUserInfo(_as_cbor_t *cbor, NSDictionary *userInfo, NSArray *keys, int depth)
+{
+    size_t header = cbor->length;
+    if (!_as_cborHead(cbor, 5, 0)) return NO;
+    uint8_t count = 0;
+    for (NSString *key in keys) {
+        if (count == kEzErrUserInfoMaxEntries) break;
+        id value = userInfo[key];
+        if (!value) continue;
+        size_t mark = cbor->length;
+        if (!_as_cborNSString(cbor, key) || !_as_cborObject(cbor, value, depth + 1)) {
+            cbor->length = mark;
+            break;
+        }
+        count++;
+    }
+    cbor->bytes[header] = (uint8_t)(5 << 5 | count);
+    return YES;
+}
+
+static inline BOOL _as_cborObject(_as_cbor_t *cbor, id value, int depth)
+{
+    if ([value isKindOfClass:[NSString class]]) return _as_cborNSString(cbor, value);
+    if ([value isKindOfClass:[NSURL class]]) return _as_cborNSString(cbor, [value absoluteString]);
+    if ([value isKindOfClass:[NSNumber class]]) {
+        const char *type = [value objCType];
+        if (!strcmp(type, @encode(BOOL)) || !strcmp(type, @encode(bool))) return _as_cborHead(cbor, 7, [value boolValue] ? _as_kCborTrue : _as_kCborFalse);
+        if (type[0] == 'f' || type[0] == 'd') return _as_cborDouble(cbor, [value doubleValue]);
+        return _as_cborInt(cbor, [value longLongValue]);
+    }
+    if ([value isKindOfClass:[NSData class]]) {
+        return _as_cborString(cbor, 2, [value bytes], [value length], kEzErrUserInfoMaxString);
+    }
+    if ([value isKindOfClass:[NSNull class]]) return _as_cborHead(cbor, 7, _as_kCborNull);
+
+    // Anything nested deeper is marked undefined
+    if (depth >= kEzErrUserInfoMaxDepth) return _as_cborHead(cbor, 7, _as_kCborUndefined);
+
+    size_t mark = cbor->length;
+    if ([value isKindOfClass:[NSError class]]) {
+        NSError *error = value;
+        BOOL fits = _as_cborHead(cbor, 5, 3)
+                 && _as_cborText(cbor, "domain") && _as_cborNSString(cbor, error.domain)
+                 && _as_cborText(cbor, "code") && _as_cborInt(cbor, error.code)
+                 && _as_cborText(cbor, "userInfo") && _as_cborUserInfo(cbor, error.userInfo, _as_allowedUserInfoKeys(), depth);
+        if (!fits) cbor->length = mark;
+        return fits;
+    }
+    if ([value isKindOfClass:[NSArray class]]) {
+        if (!_as_cborHead(cbor, 4, 0)) return NO;
+        uint8_t count = 0;
+        for (id element in value) {
+            if (count == kEzErrUserInfoMaxEntries || !_as_cborObject(cbor, element, depth + 1)) break;
+            count++;
+        }
+        cbor->bytes[mark] = (uint8_t)(4 << 5 | count);
+        return YES;
+    }
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        if (!_as_cborHead(cbor, 5, 0)) return NO;
+        uint8_t count = 0;
+        for (id key in value) {
+            if (count == kEzErrUserInfoMaxEntries) break;
+            size_t entry = cbor->length;
+            NSString *name = [key isKindOfClass:[NSString class]] ? key : NSStringFromClass([key class]);
+            if (!_as_cborNSString(cbor, name) || !_as_cborObject(cbor, value[key], depth + 1)) {
+                cbor->length = entry;
+                break;
+            }
+            count++;
+        }
+        cbor->bytes[mark] = (uint8_t)(5 << 5 | count);
+        return YES;
+    }
+
+    // Other objects are named, not described: a description can be arbitrarily slow or long
+    return _as_cborNSString(cbor, [NSString stringWithFormat:@"<%@>", NSStringFromClass([value class])]);
+}
+
+// The allowed userInfo entries as CBOR, or nil if there are none
+static inline NSData *_as_captureUserInfo(NSError *error)
+{
+    NSDictionary *userInfo = error.userInfo;
+    if (userInfo.count == 0) return nil;
+
+    uint8_t buffer[kEzErrUserInfoMaxBytes];
+    _as_cbor_t cbor = {buffer, 0, sizeof buffer};
+    if (!_as_cborUserInfo(&cbor, userInfo, _as_allowedUserInfoKeys(), 0) || cbor.length <= 1) return nil;
+    return [NSData dataWithBytes:buffer length:cbor.length];
+}
+
+// Writes the whole string straight into the buffer, with no intermediate copy
+static inline BOOL _as_cborNSText(_as_cbor_t *cbor, NSString *text)
+{
+    NSUInteger length = [text lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger used = 0;
+    size_t mark = cbor->length;
+    if (!_as_cborHead(cbor, 3, length) || cbor->capacity - cbor->length < length) {
+        cbor->length = mark;
+        return NO;
+    }
+    [text getBytes:cbor->bytes + cbor->length maxLength:length usedLength:&used encoding:NSUTF8StringEncoding
+           options:0 range:NSMakeRange(0, text.length) remainingRange:NULL];
+    if (used != length) {
+        cbor->length = mark;
+        return _as_cborHead(cbor, 3, 0);
+    }
+    cbor->length += used;
+    return YES;
+}
+
+static inline size_t ezErrEventEncodeInfo(NSDictionary *errorInfo, uint8_t *buffer, size_t capacity)
+{
+    NSError *error = errorInfo[kEzErrErrorKey];
+    _as_cbor_t cbor = {buffer, 0, capacity};
+    BOOL fits = _as_cborHead(&cbor, 6, kEzErrEventTag)
+             && _as_cborHead(&cbor, 5, _as_kEventFields + (error ? 1 : 0))
+             && _as_eventInt(&cbor, kEzErrEventVersion, 1)
+             && _as_cborInt(&cbor, kEzErrEventDetail) && _as_cborNSText(&cbor, errorInfo[kEzErrDetailKey])
+             && _as_cborInt(&cbor, kEzErrEventFile) && _as_cborNSText(&cbor, errorInfo[kEzErrFileKey])
+             && _as_cborInt(&cbor, kEzErrEventFunction) && _as_cborNSText(&cbor, errorInfo[kEzErrFunctionKey])
+             && _as_eventInt(&cbor, kEzErrEventLine, [errorInfo[kEzErrLineKey] longLongValue])
+             && _as_eventBool(&cbor, kEzErrEventMainThread, [errorInfo[kEzErrThredKey] boolValue])
+             && _as_cborInt(&cbor, kEzErrEventDate) && _as_cborDouble(&cbor, [errorInfo[kEzErrDateKey] timeIntervalSince1970])
+             && _as_cborInt(&cbor, kEzErrEventDomain) && _as_cborNSText(&cbor, errorInfo[kEzErrDomainKey])
+             && _as_eventInt(&cbor, kEzErrEventCode, [errorInfo[kEzErrCodeKey] longLongValue])
+             && _as_eventInt(&cbor, kEzErrEventClass, [errorInfo[kEzErrClassKey] intValue])
+             && _as_eventBool(&cbor, kEzErrEventFirstSeen, [errorInfo[kEzErrFirstSeenKey] boolValue])
+             && _as_cborInt(&cbor, kEzErrEventUnderlying);
+
+    size_t header = cbor.length;
+    fits = fits && _as_cborHead(&cbor, 4, 0);
+    uint8_t count = 0;
+    for (id underlying = error.userInfo[NSUnderlyingErrorKey];
+         fits && count < kEzErrEventMaxUnderlying && [underlying isKindOfClass:[NSError class]];
+         underlying = [underlying userInfo][NSUnderlyingErrorKey]) {
+        fits = _as_cborHead(&cbor, 4, 2) && _as_cborNSText(&cbor, [underlying domain]) && _as_cborInt(&cbor, [underlying code]);
+        count++;
+    }
+    if (fits) cbor.bytes[header] = (uint8_t)(4 << 5 | count);
+
+    if (fits && error) {
+        fits = _as_cborInt(&cbor, kEzErrEventUserInfo) && _as_cborUserInfo(&cbor, error.userInfo, _as_allowedUserInfoKeys(), 0);
+    }
+    return fits ? cbor.length : 0;
+}
+
+// Renders one CBOR item and its contents as JSON-like text. Runs on the writer.
+static inline BOOL _as_renderCbor(_as_cborReader_t *reader, NSMutableString *out, int depth)
+{
+    _as_cborItem item;
+    if (depth > 2 * kEzErrUserInfoMaxDepth + 2 || !_as_cborNext(reader, &item)) return NO;
+    switch (item.major) {
+        case 0: [out appendFormat:@"%llu", (unsigned long long)item.value]; return YES;
+        case 1: [out appendFormat:@"%lld", -1 - (long long)item.value]; return YES;
+        case 2: [out appendFormat:@"<%llu bytes>", (unsigned long long)item.value]; return YES;
+        case 3: {
+            NSString *text = [[NSString alloc] initWithBytes:item.bytes length:(NSUInteger)item.value encoding:NSUTF8StringEncoding];
+            [out appendFormat:@"\"%@\"", text ?: @"?"];
+            return YES;
+        }
+        case 4:
+        case 5: {
+            BOOL map = item.major == 5;
+            [out appendString:map ? @"{" : @"["];
+            for (uint64_t i = 0; i < item.value; i++) {
+                if (i) [out appendString:@", "];
+                if (map) {
+                    if (!_as_renderCbor(reader, out, depth + 1)) return NO;
+                    [out appendString:@": "];
+                }
+                if (!_as_renderCbor(reader, out, depth + 1)) return NO;
+            }
+            [out appendString:map ? @"}" : @"]"];
+            return YES;
+        }
+        case 6: return _as_renderCbor(reader, out, depth + 1);
+        default:
+            if (item.info >= 26) [out appendFormat:@"%g", item.number];
+            else if (item.value == _as_kCborFalse) [out appendString:@"false"];
+            else if (item.value == _as_kCborTrue) [out appendString:@"true"];
+            else if (item.value == _as_kCborNull) [out appendString:@"null"];
+            else [out appendString:@"..."];
+            return YES;
+    }
+}
+
+static inline NSString *_as_renderUserInfo(NSData *userInfo)
+{
+    _as_cborReader_t reader = {(const uint8_t *)userInfo.bytes, userInfo.length, 0};
+    NSMutableString *out = [NSMutableString string];
+    if (!_as_renderCbor(&reader, out, 0)) [out appendString:@" (malformed)"];
+    return out;
+}
+
+
+// MARK: - Internal request scopes
+
+struct _as_scope {
+    pthread_mutex_t lock;        // callbacks may report into one scope from several threads
+    void           *name;        // NSString, retained
+    void           *entries;     // NSMutableArray, retained
+    uint64_t        overflow;    // errors past kEzErrScopeMaxErrors since the last record
+    uint64_t        startNanos;
+    uint32_t        flushMask;
+};
+
+_as_shared pthread_key_t _as_scopeKey(void)
+{
+    static pthread_key_t key;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        pthread_key_create(&key, NULL);
+    });
+    return key;
+}
+
+static inline ezErrScope *_as_currentScope(void)
+{
+    return (ezErrScope *)pthread_getspecific(_as_scopeKey());
+}
+
+static inline ezErrScope *ezErrScopeBegin(NSString *name)
+{
+    ezErrScope *scope = (ezErrScope *)calloc(1, sizeof(ezErrScope));
+    if (!scope) return NULL;
+    pthread_mutex_init(&scope->lock, NULL);
+    scope->name = _as_bridgeRetained([name copy] ?: @"Unnamed scope");
+    scope->entries = _as_bridgeRetained([NSMutableArray new]);
+    scope->startNanos = _as_now();
+    scope->flushMask = ezErrClassMask(kEzErrClassFatal);
+    return scope;
+}
+
+static inline void ezErrScopeSetFlushClasses(ezErrScope *scope, uint32_t classMask)
+{
+    if (!scope) return;
+    __atomic_store_n(&scope->flushMask, classMask, __ATOMIC_RELAXED);
+}
+
+static inline void ezErrScopeRun(ezErrScope *scope, dispatch_block_t block)
+{
+    if (!scope) {
+        block();
+        return;
+    }
+    void *previous = pthread_getspecific(_as_scopeKey());
+    pthread_setspecific(_as_scopeKey(), scope);
+    block();
+    pthread_setspecific(_as_scopeKey(), previous);
+}
+
+// Entry layout: offset, error, detail, file, function, line, class, userInfo or NSNull
+static inline NSString *_as_scopeRecord(NSString *name, NSArray *entries, uint64_t overflow, uint64_t elapsedNanos)
+{
+    NSMutableString *record = [NSMutableString stringWithFormat:@"\n* * * * * * * * [ezErr scope: %@]"
+                                                                 "\n* Errors        : %llu in %.1f ms",
+                               name, (unsigned long long)(entries.count + overflow), elapsedNanos / 1e6];
+    NSUInteger index = 0;
+    for (NSArray *entry in entries) {
+        NSError *error = entry[1];
+        ezErrClass errorClass = (ezErrClass)[entry[6] intValue];
+        [record appendFormat:@"\n* %2lu +%8.1f ms : %@ %i%s%s%s, %@ (%@ %@:%@)",
+         (unsigned long)++index, [entry[0] unsignedLongLongValue] / 1e6, error.domain, (int)error.code,
+         errorClass != kEzErrClassUnknown ? " [" : "", errorClass != kEzErrClassUnknown ? _as_className(errorClass) : "",
+         errorClass != kEzErrClassUnknown ? "]" : "", entry[2], entry[4], entry[3], entry[5]];
+        if (entry[7] != [NSNull null]) [record appendFormat:@"\n*   User info   : %@", _as_renderUserInfo(entry[7])];
+    }
+    if (overflow) [record appendFormat:@"\n* ...and %llu more", (unsigned long long)overflow];
+    [record appendString:@"\n* * * * * * * * [End of ezErr log]"];
+    return record;
+}
+
+// Hands what has been collected to the writer as one record. Called with the lock held.
+static inline void _as_scopeEmit(ezErrScope *scope)
+{
+    NSMutableArray *entries = _as_bridge(NSMutableArray *, scope->entries);
+    if (entries.count == 0 && scope->overflow == 0) return;
+
+    NSArray *batch = [entries copy];
+    NSString *name = _as_bridge(NSString *, scope->name);
+    uint64_t overflow = scope->overflow;
+    uint64_t elapsed = _as_now() - scope->startNanos;
+    [entries removeAllObjects];
+    scope->overflow = 0;
+
+    _as_enqueueRender((name.length + 256 * batch.count) * sizeof(unichar), ^NSString *{
+        return _as_scopeRecord(name, batch, overflow, elapsed);
+    });
+}
+
+// Passes back NO if no scope is current, and the error should be logged on its own
+static inline BOOL _as_scopeAdd(NSError *error, NSString *detail, NSString *file, NSString *function, NSString *line,
+                                ezErrClass errorClass, uint64_t now, NSData *userInfo)
+{
+    ezErrScope *scope = _as_currentScope();
+    if (!scope) return NO;
+
+    pthread_mutex_lock(&scope->lock);
+    NSMutableArray *entries = _as_bridge(NSMutableArray *, scope->entries);
+    if (entries.count < kEzErrScopeMaxErrors) {
+        [entries addObject:@[@(now - scope->startNanos), error, detail, file, function, line, @(errorClass), userInfo ?: [NSNull null]]];
+    } else {
+        scope->overflow++;
+    }
+    if (__atomic_load_n(&scope->flushMask, __ATOMIC_RELAXED) & ezErrClassMask(errorClass)) _as_scopeEmit(scope);
+    pthread_mutex_unlock(&scope->lock);
+    return YES;
+}
+
+static inline void ezErrScopeEnd(ezErrScope *scope)
+{
+    if (!scope) return;
+
+    // Ended as the last thing in a run: the run puts back the scope it replaced, until then report nowhere
+    if (_as_currentScope() == scope) pthread_setspecific(_as_scopeKey(), NULL);
+
+    pthread_mutex_lock(&scope->lock);
+    _as_scopeEmit(scope);
+    pthread_mutex_unlock(&scope->lock);
+
+    (void)(__bridge_transfer NSString *)scope->name;
+    (void)(__bridge_transfer NSMutableArray *)scope->entries;
+    pthread_mutex_destroy(&scope->lock);
+    free(scope);
+}
+
+
+// Everything about a report that doesn't depend on the rendered detail
+typedef struct {
+    uint64_t    now;
+    uint64_t    siteHash;
+    int         domainSlot;
+    BOOL        firstSeen;
+    ezErrClass  errorClass;
+} _as_report;
+
+// Counts the error everywhere it is tracked. detailHash groups distinct details per domain.
+static inline _as_report _as_account(NSError *error, uint64_t detailHash, NSString *file, NSString *line, BOOL onMainThread)
+{
+    _as_report report;
+    const char *domainUTF8 = error.domain.UTF8String;
+    uint64_t domainHash = _as_hash(domainUTF8, strlen(domainUTF8));
+    report.siteHash = _as_siteHash(file.UTF8String, line.intValue);
+    uint64_t fingerprint = _as_fingerprint(report.siteHash, domainHash, error.code);
+    report.now = _as_now();
+    report.domainSlot = _as_recordStats(domainUTF8, domainHash, fingerprint, _as_mix(detailHash), onMainThread, report.now);
+    _as_sloError(report.domainSlot, report.now);
+    report.firstSeen = _as_firstSeen(fingerprint, report.now);
+    report.errorClass = _as_classify(domainHash, error.code);
+    return report;
+}
+
+static inline NSString *_as_logStatement(NSError *error, NSString *detail, NSString *file, NSString *function, NSString *line, BOOL onMainThread, _as_report report, NSArray *callStack, NSData *userInfo)
+{
+    BOOL classified = report.errorClass != kEzErrClassUnknown;
+
+    // One format call builds the whole log; optional layers are empty strings
+    return [NSString stringWithFormat:@"\n* * * * * * * * [NSError found]"
+                                       "\n* Detail        : %@"
+                                       "\n* Description   : %@"
+                                       "\n* Method name   : %@"
+                                       "\n* File name     : %@"
+                                       "\n* Line number   : %@"
+                                       "\n* Main thread   : %s"
+                                       "\n* Error domain  : %@"
+                                       "\n* Error code    : %i"
+                                       "%s%s"   // class
+                                       "%s%@"   // user info
+                                       "%s%@"   // first seen: only new kinds of error pay for the call stack
+                                       "\n* * * * * * * * [End of ezErr log]",
+            detail, error.localizedDescription, function, file, line, onMainThread? "Yes" : "No", error.domain, (int)error.code,
+            classified ? "\n* Error class   : " : "", classified ? _as_className(report.errorClass) : "",
+            userInfo ? "\n* User info     : " : "", userInfo ? _as_renderUserInfo(userInfo) : @"",
+            report.firstSeen ? "\n* First seen    : Yes\n* Call stack    :\n" : "", report.firstSeen ? [callStack componentsJoinedByString:@"\n"] : @""];
+}
+
+// Dictionary with error info for analytics or other use
+static inline NSDictionary *_as_errorInfo(NSError *error, NSString *detail, NSString *file, NSString *function, NSString *line, BOOL onMainThread, _as_report report)
+{
+    return @{kEzErrDetailKey   : detail,
+             kEzErrFileKey     : file,
+             kEzErrFunctionKey : function,
+             kEzErrLineKey     : line,
+             kEzErrThredKey    : [NSNumber numberWithBool:onMainThread],
+             kEzErrDateKey     : [NSDate date],
+             kEzErrDomainKey   : error.domain,
+             kEzErrCodeKey     : [NSString stringWithFormat:@"%i", (int)error.code],
+             kEzErrClassKey    : @(report.errorClass),
+             kEzErrFirstSeenKey : @(report.firstSeen),
+             kEzErrErrorKey    : error};
+}
+
+// Anomalies are reported after the error that revealed them. ezErr's own errors aren't tracked.
+static inline void _as_checkAnomalies(NSError *error, NSString *file, NSString *line, _as_report report)
+{
+    if ([error.domain isEqualToString:kEzErrSelfDomain]) return;
+    double rate, mean, sigma;
+    if (report.domainSlot >= 0 && _as_rateAnomaly(&_as_domainRates[report.domainSlot], report.now, &rate, &mean, &sigma)) {
+        _as_reportAnomaly(kEzErrSelfDomainRateAnomaly, [NSString stringWithFormat:@"Error rate jumped in domain %@", error.domain], rate, mean, sigma);
+    }
+    if (_as_rateAnomaly(_as_siteDetector(report.siteHash), report.now, &rate, &mean, &sigma)) {
+        _as_reportAnomaly(kEzErrSelfSiteRateAnomaly, [NSString stringWithFormat:@"Error rate jumped at %@ line %@", file, line], rate, mean, sigma);
+    }
+}
+
+// Does everything for one report except writing its log, and passes back the block that renders the log,
+// or nil if a scope lists it instead. deferredBytes is nonzero when the log should be rendered on the writer.
+static inline _as_render_t _as_reportErr(NSError *error, NSString *detail, NSString *file, NSString *function, NSString *line,
+                                         BOOL onMainThread, _as_report *report, uint64_t *deferredBytes)
+{
+    // error has already been checked by _as_isError in the calling macro
+
+    // Protect against nil fields
+    if (! detail) detail = @"No detail";
+
+    const char *detailUTF8 = detail.UTF8String;
+    _as_report accounted = *report = _as_account(error, _as_hash(detailUTF8, strlen(detailUTF8)), file, line, onMainThread);
+
+    NSArray *callStack = accounted.firstSeen ? [NSThread callStackSymbols] : nil;
+
+    // userInfo is only copied here; it is turned into text on the writer
+    NSData *userInfo = _as_captureUserInfo(error);
+    // Template mining needs the writer too
+    BOOL mining = __atomic_load_n(&_as_templateMining, __ATOMIC_RELAXED);
+    *deferredBytes = userInfo || mining ? (detail.length + 512 + userInfo.length) * sizeof(unichar) : 0;
+    _as_render_t render = nil;
+    if (!_as_scopeAdd(error, detail, file, function, line, accounted.errorClass, accounted.now, userInfo)) {
+        render = ^NSString *{
+            NSString *shown = mining ? _as_templateDetail(detail) : detail;
+            return _as_logStatement(error, shown, file, function, line, onMainThread, accounted, callStack, userInfo);
+        };
+    }
+
+    [[NSNotificationCenter defaultCenter] postNotificationName:kEzErrNotification
+                                                        object:nil
+                                                      userInfo:_as_errorInfo(error, detail, file, function, line, onMainThread, accounted)];
+    return render;
+}
+
+static inline const char *_as_fileName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+//Performs the logging and notification sending
+
+static inline void _as_logErr(NSError *error,
+                              NSString *detail,
+                              NSString *file,
+                              NSString *function,
+                              NSString *line,
+                              BOOL onMainThread)
+
+{
+    _as_report report;
+    uint64_t deferredBytes;
+    _as_render_t render = _as_reportErr(error, detail, file, function, line, onMainThread, &report, &deferredBytes);
+    if (render && deferredBytes) _as_enqueueRender(deferredBytes, render);
+    else if (render) _as_enqueueLog(render());
+
+    _as_checkAnomalies(error, file, line, report);
+}
+
+// Reports every error in the collection from one site, with one reservation on the writer queue for all their logs
+static inline NSUInteger _as_logErrBatch(id<NSFastEnumeration> errors, NSString *detail, const char *file, const char *function, int line)
+{
+    NSString *fileName = @(_as_fileName(file)), *functionName = @(function), *lineString = [NSString stringWithFormat:@"%d", line];
+    BOOL onMainThread = [NSThread isMainThread];
+    NSMutableArray *renders = [NSMutableArray new], *reported = [NSMutableArray new];
+    NSMutableData *reports = [NSMutableData new];
+    uint64_t estimate = 0;
+    NSUInteger failures = 0;
+
+    for (id error in errors) {
+        if (!_as_isError(error)) continue;
+        failures++;
+        _as_report report;
+        uint64_t deferredBytes;
+        _as_render_t render = _as_reportErr(error, detail, fileName, functionName, lineString, onMainThread, &report, &deferredBytes);
+        if (render) {
+            [renders addObject:render];
+            estimate += deferredBytes ? deferredBytes : (detail.length + 512) * sizeof(unichar);
+        }
+        [reported addObject:error];
+        [reports appendBytes:&report length:sizeof report];
+    }
+
+    if (renders.count) _as_enqueueRenders(estimate, renders);
+
+    const _as_report *list = (const _as_report *)reports.bytes;
+    for (NSUInteger i = 0; i < reported.count; i++) {
+        _as_checkAnomalies(reported[i], fileName, lineString, list[i]);
+    }
+    return failures;
+}
+
+// MARK: - Internal repeats
+
+#define _as_kRepeatSlots 8
+
+// Pointers are retained, so a pointer match really is the same object
+typedef struct {
+    const char *site;         // __FILE__, compared by pointer
+    int         line;
+    BOOL        onMainThread; // of the latest repeat
+    void       *error;
+    void       *detail;
+    void       *file;
+    void       *function;
+    void       *lineString;
+    uint64_t    domainHash;
+    uint64_t    fingerprint;
+    uint64_t    siteHash;
+    uint64_t    detailHash;
+    uint64_t    bytes;        // charged to kEzErrMemoryRepeats
+    uint64_t    repeats;      // since the last sweep
+} _as_repeatEntry;
+
+// One per reporting thread. The thread holds the lock while it uses an entry, and the sweep holds it to take repeats,
+// so it is only contended while a sweep passes.
+typedef struct _as_repeatCache_t {
+    pthread_mutex_t           lock;
+    struct _as_repeatCache_t *next;
+    struct _as_repeatCache_t *prev;
+    _as_repeatEntry           entries[_as_kRepeatSlots];
+} _as_repeatCache_t;
+
+// Shared, like the key, so every file that imports ezErr.h uses one cache per thread
+_as_shared __thread _as_repeatCache_t *_as_repeatCache;
+_as_shared pthread_mutex_t _as_repeatCachesLock = PTHREAD_MUTEX_INITIALIZER;
+_as_shared _as_repeatCache_t *_as_repeatCaches; // every thread's, under _as_repeatCachesLock
+_as_shared dispatch_source_t _as_repeatWake;    // DATA_OR on the writer queue, starts the sweep
+_as_shared uint64_t _as_repeatSweeping;         // while a sweep is due
+
+// Takes the entry's repeats since the last sweep, as the userInfo of their summary. Under the cache's lock.
+static inline NSDictionary *_as_repeatTake(_as_repeatEntry *entry)
+{
+    uint64_t repeats = __atomic_exchange_n(&entry->repeats, 0, __ATOMIC_SEQ_CST);
+    if (!repeats) return nil;
+    NSError *error = _as_bridge(NSError *, entry->error);
+    NSString *detail = _as_bridge(NSString *, entry->detail) ?: @"No detail";
+    _as_report report = {_as_now(), 0, -1, NO, _as_classOf(error)};
+    NSMutableDictionary *errorInfo = [_as_errorInfo(error, detail, _as_bridge(NSString *, entry->file), _as_bridge(NSString *, entry->function),
+                                                    _as_bridge(NSString *, entry->lineString), entry->onMainThread, report) mutableCopy];
+    errorInfo[kEzErrRepeatsKey] = @(repeats);
+    return errorInfo;
+}
+
+// Logs and posts repeat summaries. Never under a cache's lock: observers may report errors of their own.
+static inline void _as_repeatPost(NSArray *summaries)
+{
+    for (NSDictionary *errorInfo in summaries) {
+        _as_enqueueLog([NSString stringWithFormat:@"\n* * * * * * * * [NSError repeated]"
+                                                   "\n* Detail        : %@"
+                                                   "\n* Method name   : %@"
+                                                   "\n* File name     : %@"
+                                                   "\n* Line number   : %@"
+                                                   "\n* Error domain  : %@"
+                                                   "\n* Error code    : %@"
+                                                   "\n* Repeats       : %@"
+                                                   "\n* * * * * * * * [End of ezErr log]",
+                        errorInfo[kEzErrDetailKey], errorInfo[kEzErrFunctionKey], errorInfo[kEzErrFileKey], errorInfo[kEzErrLineKey],
+                        errorInfo[kEzErrDomainKey], errorInfo[kEzErrCodeKey], errorInfo[kEzErrRepeatsKey]]);
+        [[NSNotificationCenter defaultCenter] postNotificationName:kEzErrNotification object:nil userInfo:errorInfo];
+    }
+}
+
+// Drops the entry and passes back the summary of any repeats it still held. Under the cache's lock.
+static inline NSDictionary *_as_repeatForget(_as_repeatEntry *entry)
+{
+    if (!entry->error) return nil;
+    NSDictionary *summary = _as_repeatTake(entry);
+    void *retained[] = {entry->error, entry->detail, entry->file, entry->function, entry->lineString};
+    for (size_t i = 0; i < sizeof retained / sizeof retained[0]; i++) {
+        if (retained[i]) (void)(__bridge_transfer id)retained[i];
+    }
+    _as_memoryRelease(kEzErrMemoryRepeats, entry->bytes);
+    memset(entry, 0, sizeof *entry);
+    return summary;
+}
+
+// Drops every thread's remembered reports to make room under the memory budget
+static inline void _as_repeatEvict(void)
+{
+    @autoreleasepool {
+        NSMutableArray *summaries = [NSMutableArray new];
+        pthread_mutex_lock(&_as_repeatCachesLock);
+        for (_as_repeatCache_t *cache = _as_repeatCaches; cache; cache = cache->next) {
+            pthread_mutex_lock(&cache->lock);
+            for (int i = 0; i < _as_kRepeatSlots; i++) {
+                NSDictionary *summary = _as_repeatForget(&cache->entries[i]);
+                if (summary) [summaries addObject:summary];
+            }
+            pthread_mutex_unlock(&cache->lock);
+        }
+        pthread_mutex_unlock(&_as_repeatCachesLock);
+        _as_repeatPost(summaries);
+    }
+}
+
+static inline void _as_repeatTakeAll(NSMutableArray *summaries)
+{
+    pthread_mutex_lock(&_as_repeatCachesLock);
+    for (_as_repeatCache_t *cache = _as_repeatCaches; cache; cache = cache->next) {
+        pthread_mutex_lock(&cache->lock);
+        for (int i = 0; i < _as_kRepeatSlots; i++) {
+            NSDictionary *summary = cache->entries[i].error ? _as_repeatTake(&cache->entries[i]) : nil;
+            if (summary) [summaries addObject:summary];
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    pthread_mutex_unlock(&_as_repeatCachesLock);
+}
+
+static inline void _as_repeatSweep(void);
+
+// With no memory for the timer the sweep stops, and the next repeat tries to start it again
+static inline void _as_repeatSweepLater(void)
+{
+    _as_timer *timer = _as_timerAdd(kEzErrRepeatInterval, 0, ^{
+        _as_repeatSweep();
+    });
+    if (!timer) __atomic_store_n(&_as_repeatSweeping, 0, __ATOMIC_SEQ_CST);
+}
+
+// Runs every kEzErrRepeatInterval while repeats keep coming, and stops after an interval with none.
+// A repeat that lands after the last look starts it again through _as_repeatWake.
+static inline void _as_repeatSweep(void)
+{
+    @autoreleasepool {
+        NSMutableArray *summaries = [NSMutableArray new];
+        _as_repeatTakeAll(summaries);
+        BOOL again = summaries.count > 0;
+        if (!again) {
+            __atomic_store_n(&_as_repeatSweeping, 0, __ATOMIC_SEQ_CST);
+            _as_repeatTakeAll(summaries);
+            // A reporter that saw the flag down has woken a sweep of its own
+            again = summaries.count > 0 && !__atomic_exchange_n(&_as_repeatSweeping, 1, __ATOMIC_SEQ_CST);
+        }
+        _as_repeatPost(summaries);
+        if (again) _as_repeatSweepLater();
+    }
+}
+
+// No allocation and no block: the reporting thread only signals the writer, and only when no sweep is due
+static inline void _as_repeatWakeSweep(void)
+{
+    if (__atomic_load_n(&_as_repeatSweeping, __ATOMIC_SEQ_CST) || __atomic_exchange_n(&_as_repeatSweeping, 1, __ATOMIC_SEQ_CST)) return;
+    dispatch_source_merge_data(_as_repeatWake, 1);
+}
+
+// Torn down by the key's destructor when the thread exits
+static inline void _as_repeatCacheFree(void *pointer)
+{
+    _as_repeatCache_t *cache = (_as_repeatCache_t *)pointer;
+    pthread_mutex_lock(&_as_repeatCachesLock);
+    if (cache->prev) cache->prev->next = cache->next;
+    else _as_repeatCaches = cache->next;
+    if (cache->next) cache->next->prev = cache->prev;
+    pthread_mutex_unlock(&_as_repeatCachesLock);
+
+    @autoreleasepool {
+        NSMutableArray *summaries = [NSMutableArray new];
+        for (int i = 0; i < _as_kRepeatSlots; i++) {
+            NSDictionary *summary = _as_repeatForget(&cache->entries[i]);
+            if (summary) [summaries addObject:summary];
+        }
+        _as_repeatPost(summaries);
+    }
+    _as_memoryRelease(kEzErrMemoryRepeats, sizeof(_as_repeatCache_t));
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+    _as_repeatCache = NULL; // another key's destructor may still report
+}
+
+_as_shared pthread_key_t _as_repeatKey(void)
+{
+    static pthread_key_t key;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        pthread_key_create(&key, _as_repeatCacheFree);
+        _as_repeatWake = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, _as_writerQueue());
+        dispatch_source_set_event_handler(_as_repeatWake, ^{
+            _as_repeatSweepLater();
+        });
+        dispatch_resume(_as_repeatWake);
+    });
+    return key;
+}
+
+// Passes back NULL if the budget has no room for a new cache
+static inline _as_repeatCache_t *_as_repeatCacheGet(void)
+{
+    if (_as_repeatCache) return _as_repeatCache;
+    if (!_as_memoryAdmit(sizeof(_as_repeatCache_t))) return NULL;
+    _as_repeatCache_t *cache = (_as_repeatCache_t *)calloc(1, sizeof(_as_repeatCache_t));
+    if (!cache) return NULL;
+    _as_memoryCharge(kEzErrMemoryRepeats, sizeof(_as_repeatCache_t));
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_setspecific(_as_repeatKey(), cache);
+
+    pthread_mutex_lock(&_as_repeatCachesLock);
+    cache->next = _as_repeatCaches;
+    if (cache->next) cache->next->prev = cache;
+    _as_repeatCaches = cache;
+    pthread_mutex_unlock(&_as_repeatCachesLock);
+    return _as_repeatCache = cache;
+}
+
+static inline _as_repeatEntry *_as_repeatEntryAt(_as_repeatCache_t *cache, const char *file, int line)
+{
+    return &cache->entries[_as_mix((uintptr_t)file ^ (uint64_t)line) % _as_kRepeatSlots];
+}
+
+// Counts the report if it repeats the last one at its site, without touching any string. Passes back NO if it doesn't.
+static inline BOOL _as_logRepeat(_as_repeatCache_t *cache, NSError *error, NSString *detail, const char *file, int line, BOOL onMainThread)
+{
+    _as_repeatEntry *entry = _as_repeatEntryAt(cache, file, line);
+    pthread_mutex_lock(&cache->lock);
+    if (entry->site != file || entry->line != line || entry->error != _as_bridge(void *, error) || entry->detail != _as_bridge(void *, detail)) {
+        pthread_mutex_unlock(&cache->lock);
+        return NO;
+    }
+    entry->onMainThread = onMainThread;
+    __atomic_fetch_add(&entry->repeats, 1, __ATOMIC_SEQ_CST);
+    uint64_t domainHash = entry->domainHash, fingerprint = entry->fingerprint, detailHash = entry->detailHash, siteHash = entry->siteHash;
+    NSString *fileName = _as_bridge(NSString *, entry->file), *lineString = _as_bridge(NSString *, entry->lineString);
+    pthread_mutex_unlock(&cache->lock);
+    _as_repeatWakeSweep();
+
+    uint64_t now = _as_now();
+    int domainSlot = _as_recordStats(error.domain.UTF8String, domainHash, fingerprint, detailHash, onMainThread, now);
+    _as_sloError(domainSlot, now);
+    __atomic_fetch_add(&_as_stats.repeats, 1, __ATOMIC_RELAXED);
+
+    _as_report report = {now, siteHash, domainSlot, NO, kEzErrClassUnknown};
+    _as_checkAnomalies(error, fileName, lineString, report);
+    return YES;
+}
+
+// Remembers a report so the next identical one at its site can skip formatting
+static inline void _as_repeatRemember(_as_repeatCache_t *cache, NSError *error, NSString *detail, const char *site, int line,
+                                      NSString *file, NSString *function, NSString *lineString)
+{
+    // The error is shared with the caller; the strings are ours
+    uint64_t bytes = (detail.length + file.length + function.length + lineString.length) * sizeof(unichar);
+    BOOL admitted = _as_memoryAdmit(bytes);
+    const char *domainUTF8 = error.domain.UTF8String;
+    const char *detailUTF8 = (detail ?: @"No detail").UTF8String;
+    uint64_t domainHash = _as_hash(domainUTF8, strlen(domainUTF8));
+    uint64_t siteHash = _as_siteHash(file.UTF8String, line);
+
+    _as_repeatEntry *entry = _as_repeatEntryAt(cache, site, line);
+    pthread_mutex_lock(&cache->lock);
+    NSDictionary *summary = _as_repeatForget(entry);
+    if (admitted) {
+        _as_memoryCharge(kEzErrMemoryRepeats, bytes);
+        entry->bytes = bytes;
+        entry->site = site;
+        entry->line = line;
+        entry->error = _as_bridgeRetained(error);
+        entry->detail = detail ? _as_bridgeRetained(detail) : NULL;
+        entry->file = _as_bridgeRetained(file);
+        entry->function = _as_bridgeRetained(function);
+        entry->lineString = _as_bridgeRetained(lineString);
+        entry->domainHash = domainHash;
+        entry->siteHash = siteHash;
+        entry->fingerprint = _as_fingerprint(siteHash, domainHash, error.code);
+        entry->detailHash = _as_mix(_as_hash(detailUTF8, strlen(detailUTF8)));
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (summary) _as_repeatPost(@[summary]);
+}
+
+// The macros' entry point. Site strings are made here, inside the macro's pool.
+static inline void _as_logErrAt(NSError *error, NSString *detail, const char *file, const char *function, int line)
+{
+    BOOL onMainThread = [NSThread isMainThread];
+    _as_repeatCache_t *cache = _as_repeatCacheGet();
+    // A scope lists every error, so repeats inside one take the full path
+    if (cache && !_as_currentScope() && _as_logRepeat(cache, error, detail, file, line, onMainThread)) return;
+
+    NSString *fileName = @(_as_fileName(file)), *functionName = @(function), *lineString = [NSString stringWithFormat:@"%d", line];
+    _as_logErr(error, detail, fileName, functionName, lineString, onMainThread);
+    if (cache) _as_repeatRemember(cache, error, detail, file, line, fileName, functionName, lineString);
+}
+
+#if defined(__cplusplus) && __cplusplus >= 201402L
+template <typename Captured, size_t... I>
+static inline NSString *_as_formatDetail(const char *format, const Captured &captured, std::index_sequence<I...> indices)
+{
+    std::string rendered = _as_renderFormat(format, captured, indices);
+    return [NSString stringWithUTF8String:rendered.c_str()] ?: @"No detail";
+}
+
+// The ezErrF path: accounting happens here, the detail and log are rendered on the writer
+template <typename... Args>
+static inline void _as_logErrFormat(NSError *error, const char *format, const char *fileUTF8, const char *functionUTF8, int lineNumber, const Args &...args)
+{
+    typedef std::tuple<typename _as_captured<typename std::decay<Args>::type>::type...> Captured;
+    static_assert(_as_all(_as_formattable<typename _as_captured<typename std::decay<Args>::type>::type>::value...),
+                  "ezErrF: arguments must be numbers, bools, enums, C strings, std::strings or Objective-C objects");
+    Captured captured(args...);
+
+    NSString *file = @(_as_fileName(fileUTF8));
+    NSString *function = @(functionUTF8);
+    NSString *line = [NSString stringWithFormat:@"%d", lineNumber];
+    BOOL onMainThread = [NSThread isMainThread];
+    _as_report report = _as_account(error, _as_hash(format, strlen(format)), file, line, onMainThread);
+    NSArray *callStack = report.firstSeen ? [NSThread callStackSymbols] : nil;
+    NSData *userInfo = _as_captureUserInfo(error);
+
+    // Scope records hold finished details, so inside a scope the detail is rendered here instead of on the writer
+    if (_as_currentScope()) {
+        NSString *detail = _as_formatDetail(format, captured, std::index_sequence_for<Args...>());
+        if (_as_scopeAdd(error, detail, file, function, line, report.errorClass, report.now, userInfo)) {
+            [[NSNotificationCenter defaultCenter] postNotificationName:kEzErrNotification
+                                                                object:nil
+                                                              userInfo:_as_errorInfo(error, detail, file, function, line, onMainThread, report)];
+            _as_checkAnomalies(error, file, line, report);
+            return;
+        }
+    }
+
+    uint64_t estimate = (strlen(format) + 512 + userInfo.length) * sizeof(unichar);
+    _as_enqueueRender(estimate, ^NSString *{
+        NSString *detail = _as_formatDetail(format, captured, std::index_sequence_for<Args...>());
+        NSDictionary *errorInfo = _as_errorInfo(error, detail, file, function, line, onMainThread, report);
+        dispatch_async(dispatch_get_global_queue(_as_kUtilityQoS, 0), ^{
+            [[NSNotificationCenter defaultCenter] postNotificationName:kEzErrNotification
+                                                                object:nil
+                                                              userInfo:errorInfo];
+        });
+        return _as_logStatement(error, _as_minedDetail(detail), file, function, line, onMainThread, report, callStack, userInfo);
+    });
+
+    _as_checkAnomalies(error, file, line, report);
+}
+#endif
+
+
+// C strings that aren't UTF-8 are read as Latin-1 rather than dropped
+static inline NSString *_as_cString(const char *string)
+{
+    return @(string) ?: [NSString stringWithCString:string encoding:NSISOLatin1StringEncoding];
+}
+
+// Turns queued C reports into NSErrors and sends them down the usual path
+#ifdef __cplusplus
+extern "C"
+#endif
+_as_shared void _as_drainCReports(void *context)
+{
+    for (;;) {
+        _as_cReport *report = &_as_cRing.slots[_as_cRing.tail % _as_kCRingSlots];
+        uint64_t round = _as_cRing.tail / _as_kCRingSlots;
+        if (__atomic_load_n(&report->turn, __ATOMIC_ACQUIRE) != 2 * round + 1) return;
+
+        @autoreleasepool {
+            const ezerr_site *site = report->site;
+            NSError *error = [NSError errorWithDomain:_as_cString(report->domain) code:(NSInteger)report->code userInfo:nil];
+            _as_logErr(error,
+                       report->detail[0] ? _as_cString(report->detail) : nil,
+                       _as_cString(_as_fileName(site->file)),
+                       _as_cString(site->function),
+                       [NSString stringWithFormat:@"%d", site->line],
+                       report->onMainThread);
+        }
+
+        __atomic_store_n(&report->turn, 2 * round + 2, __ATOMIC_RELEASE);
+        _as_cRing.tail++;
+    }
+}
+#endif
+
+
+// Under a steady stream of reports every copy can overlap one. After this many the last copy is kept, marked torn.
+#define _as_kSnapshotTries 64
+
+static inline void _as_copySinkStats(ezErrSinkStats *to, ezErrSinkStats *from)
+{
+    to->writes           = __atomic_load_n(&from->writes, __ATOMIC_RELAXED);
+    to->errors           = __atomic_load_n(&from->errors, __ATOMIC_RELAXED);
+    to->lastLatencyNanos = __atomic_load_n(&from->lastLatencyNanos, __ATOMIC_RELAXED);
+    to->maxLatencyNanos  = __atomic_load_n(&from->maxLatencyNanos, __ATOMIC_RELAXED);
+}
+
+// The table slots with the most errors, most first. The table is small, so it is an insertion into a short sorted list.
+static inline int _as_topDomainSlots(const _as_domainSlot *domains, int top[kEzErrStatsTopDomains])
+{
+    int count = 0;
+    for (int i = 0; i < _as_kDomainSlots; i++) {
+        if (!domains[i].name || !domains[i].count) continue;
+        int at = count;
+        while (at > 0 && domains[top[at - 1]].count < domains[i].count) at--;
+        if (at >= kEzErrStatsTopDomains) continue;
+        int last = count < kEzErrStatsTopDomains ? count : kEzErrStatsTopDomains - 1;
+        memmove(&top[at + 1], &top[at], (last - at) * sizeof(int));
+        top[at] = i;
+        if (count < kEzErrStatsTopDomains) count++;
+    }
+    return count;
+}
+
+static inline void ezErrStatsSnapshot(ezErrStats *stats)
+{
+    _as_stats_t copy;
+    int top[kEzErrStatsTopDomains], topCount = 0;
+    ezErrHLL topSketches[kEzErrStatsTopDomains];
+    uint64_t epoch = _as_now() / ((uint64_t)kEzErrCardinalityWindow * 1000000000ull) + 1;
+    _as_window_t *window = &_as_windows[epoch & 1];
+    BOOL torn = YES;
+    for (int attempt = 0; torn && attempt < _as_kSnapshotTries; attempt++) {
+        uint64_t begins[_as_kStatsStripes];
+        BOOL inFlight = NO;
+        for (int i = 0; i < _as_kStatsStripes; i++) {
+            uint64_t end = __atomic_load_n(&_as_statsStripes[i].end, __ATOMIC_ACQUIRE);
+            begins[i] = __atomic_load_n(&_as_statsStripes[i].begin, __ATOMIC_RELAXED);
+            inFlight |= begins[i] != end;
+        }
+
+        copy.count            = __atomic_load_n(&_as_stats.count, __ATOMIC_RELAXED);
+        copy.mainThreadCount  = __atomic_load_n(&_as_stats.mainThreadCount, __ATOMIC_RELAXED);
+        copy.firstNanos       = __atomic_load_n(&_as_stats.firstNanos, __ATOMIC_RELAXED);
+        copy.lastNanos        = __atomic_load_n(&_as_stats.lastNanos, __ATOMIC_RELAXED);
+        copy.otherDomainCount = __atomic_load_n(&_as_stats.otherDomainCount, __ATOMIC_RELAXED);
+        copy.queueDepth       = __atomic_load_n(&_as_stats.queueDepth, __ATOMIC_RELAXED);
+        copy.flushMode        = __atomic_load_n(&_as_stats.flushMode, __ATOMIC_RELAXED);
+        copy.batchTarget      = __atomic_load_n(&_as_stats.batchTarget, __ATOMIC_RELAXED);
+        copy.lastBatchSize    = __atomic_load_n(&_as_stats.lastBatchSize, __ATOMIC_RELAXED);
+        copy.maxBatchSize     = __atomic_load_n(&_as_stats.maxBatchSize, __ATOMIC_RELAXED);
+        copy.flushCount       = __atomic_load_n(&_as_stats.flushCount, __ATOMIC_RELAXED);
+        copy.failedOver       = __atomic_load_n(&_as_stats.failedOver, __ATOMIC_RELAXED);
+        _as_copySinkStats(&copy.fileSink, &_as_stats.fileSink);
+        _as_copySinkStats(&copy.fallbackSink, &_as_stats.fallbackSink);
+        for (int i = 0; i < kEzErrMemoryComponentCount; i++) {
+            copy.memoryUsage[i] = __atomic_load_n(&_as_stats.memoryUsage[i], __ATOMIC_RELAXED);
+        }
+        copy.droppedLogs      = __atomic_load_n(&_as_stats.droppedLogs, __ATOMIC_RELAXED);
+        copy.repeats          = __atomic_load_n(&_as_stats.repeats, __ATOMIC_RELAXED);
+        for (int i = 0; i < _as_kDomainSlots; i++) {
+            copy.domains[i].name  = __atomic_load_n(&_as_stats.domains[i].name, __ATOMIC_RELAXED);
+            copy.domains[i].count = __atomic_load_n(&_as_stats.domains[i].count, __ATOMIC_RELAXED);
+        }
+        topCount = _as_topDomainSlots(copy.domains, top);
+        BOOL current = __atomic_load_n(&window->epoch, __ATOMIC_RELAXED) == epoch;
+        for (int i = 0; i < topCount; i++) {
+            for (int r = 0; r < kEzErrHLLRegisters; r++) {
+                topSketches[i].registers[r] = current ? __atomic_load_n(&window->domains[top[i]].registers[r], __ATOMIC_RELAXED) : 0;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        torn = inFlight;
+        for (int i = 0; i < _as_kStatsStripes && !torn; i++) {
+            torn = __atomic_load_n(&_as_statsStripes[i].begin, __ATOMIC_RELAXED) != begins[i];
+        }
+        if (torn) sched_yield(); // a writer may be descheduled mid-report; let it finish
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->torn             = torn;
+    stats->count            = copy.count;
+    stats->mainThreadCount  = copy.mainThreadCount;
+    stats->firstNanos       = copy.firstNanos;
+    stats->lastNanos        = copy.lastNanos;
+    stats->otherDomainCount = copy.otherDomainCount;
+    stats->queueDepth       = copy.queueDepth;
+    stats->flushMode        = (ezErrFlushMode)copy.flushMode;
+    stats->batchTarget      = copy.batchTarget;
+    stats->lastBatchSize    = copy.lastBatchSize;
+    stats->maxBatchSize     = copy.maxBatchSize;
+    stats->flushCount       = copy.flushCount;
+    stats->failedOver       = copy.failedOver != 0;
+    stats->fileSink         = copy.fileSink;
+    stats->fallbackSink     = copy.fallbackSink;
+    stats->memoryBudget     = __atomic_load_n(&_as_memoryBudget, __ATOMIC_RELAXED);
+    memcpy(stats->memoryUsage, copy.memoryUsage, sizeof(stats->memoryUsage));
+    stats->droppedLogs      = copy.droppedLogs;
+    stats->repeats          = copy.repeats;
+
+    double span = (copy.lastNanos - copy.firstNanos) / 1e9;
+    stats->ratePerSecond = span > 0 ? copy.count / span : copy.count;
+
+    stats->topDomainCount = topCount;
+    for (int i = 0; i < topCount; i++) {
+        stats->topDomains[i].domain        = copy.domains[top[i]].name;
+        stats->topDomains[i].count         = copy.domains[top[i]].count;
+        stats->topDomains[i].distinctKinds = ezErrHLLEstimate(&topSketches[i]);
+    }
+}
+
+
+static inline double ezErrHLLEstimate(const ezErrHLL *hll)
+{
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < kEzErrHLLRegisters; i++) {
+        uint8_t rank = __atomic_load_n(&hll->registers[i], __ATOMIC_RELAXED);
+        sum += 1.0 / (double)(1ull << rank);
+        if (rank == 0) zeros++;
+    }
+    double m = kEzErrHLLRegisters;
+    double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    // Small range correction: linear counting while many registers are still empty
+    if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+    return estimate;
+}
+
+static inline void ezErrHLLMerge(ezErrHLL *into, const ezErrHLL *from)
+{
+    for (int i = 0; i < kEzErrHLLRegisters; i++) {
+        if (from->registers[i] > into->registers[i]) into->registers[i] = from->registers[i];
+    }
+}
+
+static inline BOOL ezErrCardinalityWindow(int windowsAgo, ezErrCardinality *cardinality)
+{
+    uint64_t windowNanos = (uint64_t)kEzErrCardinalityWindow * 1000000000ull;
+    uint64_t epoch = _as_now() / windowNanos + 1;
+    if (windowsAgo < 0 || windowsAgo > 1 || epoch <= (uint64_t)windowsAgo) return NO;
+
+    epoch -= windowsAgo;
+    _as_window_t *window = &_as_windows[epoch & 1];
+    if (__atomic_load_n(&window->epoch, __ATOMIC_ACQUIRE) != epoch) return NO;
+
+    for (int i = 0; i < kEzErrHLLRegisters; i++) {
+        cardinality->kinds.registers[i]   = __atomic_load_n(&window->kinds.registers[i], __ATOMIC_RELAXED);
+        cardinality->details.registers[i] = __atomic_load_n(&window->details.registers[i], __ATOMIC_RELAXED);
+    }
+    cardinality->startNanos      = (epoch - 1) * windowNanos;
+    cardinality->distinctKinds   = ezErrHLLEstimate(&cardinality->kinds);
+    cardinality->distinctDetails = ezErrHLLEstimate(&cardinality->details);
+    return YES;
 }
 
 